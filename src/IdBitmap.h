@@ -0,0 +1,69 @@
+#ifndef __IDBITMAP_H__
+#define __IDBITMAP_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+
+// Set of (node or way) ids, one bit per id.
+// Bits are held in blocks of 2^BlockBits ids which are only allocated once an id of their range is added,
+// so id ranges without any added id (or beyond the highest id) take no memory.
+class IdBitmap
+{
+	static const int BlockBits = 20;							// 1M ids (128KB) per block
+	static const uint64_t NumWordsPerBlock = (1ull << BlockBits) / 64;
+
+public:
+	IdBitmap()
+		: numIds(0)
+	{
+	}
+
+	void Add(const uint64_t id)
+	{
+		const uint64_t blockIndex = id >> BlockBits;
+		if (blockIndex >= blocks.size())
+		{
+			blocks.resize(blockIndex + 1);
+		}
+
+		auto& block = blocks[blockIndex];
+		if (!block)
+		{
+			block.reset(new uint64_t[NumWordsPerBlock]);
+			memset(block.get(), 0, NumWordsPerBlock * sizeof(uint64_t));
+		}
+
+		uint64_t& word = block[(id & ((1ull << BlockBits) - 1)) >> 6];
+		const uint64_t bit = 1ull << (id & 63);
+		numIds += (word & bit) ? 0 : 1;
+		word |= bit;
+	}
+
+	bool Contains(const uint64_t id) const
+	{
+		const uint64_t blockIndex = id >> BlockBits;
+		if (blockIndex >= blocks.size() || !blocks[blockIndex]) return false;
+
+		return (blocks[blockIndex][(id & ((1ull << BlockBits) - 1)) >> 6] >> (id & 63)) & 1;
+	}
+
+	uint64_t GetNumIds() const { return numIds; }
+
+	uint64_t GetSizeInBytes() const
+	{
+		uint64_t numBlocks = 0;
+		for (const auto& block : blocks)
+		{
+			numBlocks += block ? 1 : 0;
+		}
+		return numBlocks * NumWordsPerBlock * sizeof(uint64_t) + blocks.size() * sizeof(blocks[0]);
+	}
+
+private:
+	std::vector<std::unique_ptr<uint64_t[]>> blocks;
+	uint64_t numIds;
+};
+
+#endif // __IDBITMAP_H__
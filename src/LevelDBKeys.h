@@ -0,0 +1,154 @@
+#ifndef __LEVELDBKEYS_H__
+#define __LEVELDBKEYS_H__
+
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <leveldb/db.h>
+#include <leveldb/write_batch.h>
+#include <leveldb/comparator.h>
+
+// 8 byte big-endian key, so leveldb's default bytewise comparator sorts keys by id.
+// Neighbouring ids share their leading bytes, which leveldb's prefix compressed blocks and
+// shortened index keys (FindShortestSeparator() of the bytewise comparator) make use of.
+class BigEndianKey
+{
+public:
+	BigEndianKey(const uint64_t id)
+	{
+		for (int b = 0; b < 8; b++)
+		{
+			bytes[b] = (char)(id >> (56 - 8 * b));
+		}
+	}
+
+	leveldb::Slice ToSlice() const { return leveldb::Slice(bytes, sizeof(bytes)); }
+
+	static uint64_t ToId(const leveldb::Slice& key)
+	{
+		uint64_t id = 0;
+		for (int b = 0; b < 8; b++)
+		{
+			id = (id << 8) | (uint8_t)key[b];
+		}
+		return id;
+	}
+
+private:
+	char bytes[8];
+};
+
+// Comparator of databases written before keys were big-endian (native uint64_t keys).
+// Only needed to read such databases once for migration (see OpenBigEndianKeyedDB()).
+class LegacyOSMIdComparator : public leveldb::Comparator
+{
+public:
+	virtual int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const
+	{
+		const uint64_t idA = ToId(a);
+		const uint64_t idB = ToId(b);
+		if (idA == idB) return 0;
+		return idA < idB ? -1 : 1;
+	}
+
+	virtual const char* Name() const
+	{
+		return "OSMIdComparator"; // name stored in existing databases, must not change
+	}
+
+	virtual void FindShortestSeparator(std::string* start, const leveldb::Slice& limit) const {};
+	virtual void FindShortSuccessor(std::string* key) const {};
+
+	static uint64_t ToId(const leveldb::Slice& key)
+	{
+		uint64_t id;
+		memcpy(&id, key.data(), sizeof(uint64_t));
+		return id;
+	}
+};
+
+// Opens a database with big-endian keys and the default comparator.
+// A database still using LegacyOSMIdComparator (leveldb refuses to open it with a different comparator)
+// is rewritten with big-endian keys first. Values are copied unchanged.
+inline leveldb::Status OpenBigEndianKeyedDB(const leveldb::Options& options, const std::string& filePath, leveldb::DB** db)
+{
+	*db = NULL;
+	leveldb::Status status = leveldb::DB::Open(options, filePath, db);
+	if (status.ok() || !status.IsInvalidArgument()) return status;
+
+	LegacyOSMIdComparator legacyComparator;
+	leveldb::Options legacyOptions = options;
+	legacyOptions.comparator = &legacyComparator;
+	legacyOptions.create_if_missing = false;
+
+	leveldb::DB* legacyDB = NULL;
+	status = leveldb::DB::Open(legacyOptions, filePath, &legacyDB);
+	if (!status.ok()) return status;
+
+	printf("Migrating %s to big-endian keys\n", filePath.c_str());
+
+	const std::string migratedFilePath = filePath + ".migrating";
+	leveldb::DestroyDB(migratedFilePath, options); // leftovers of an interrupted migration
+
+	leveldb::Options migratedOptions = options;
+	migratedOptions.create_if_missing = true;
+	leveldb::DB* migratedDB = NULL;
+	status = leveldb::DB::Open(migratedOptions, migratedFilePath, &migratedDB);
+	if (!status.ok())
+	{
+		delete legacyDB;
+		return status;
+	}
+
+	// keys are visited in id order, so the new database is written (mostly) append only
+	const size_t WriteBatchSize = 4 << 20;
+	leveldb::WriteBatch writeBatch;
+	size_t numBytesInBatch = 0;
+	leveldb::WriteOptions wo;
+	leveldb::ReadOptions ro;
+	ro.fill_cache = false;
+
+	leveldb::Iterator* iterator = legacyDB->NewIterator(ro);
+	for (iterator->SeekToFirst(); iterator->Valid() && status.ok(); iterator->Next())
+	{
+		const leveldb::Slice value = iterator->value();
+		writeBatch.Put(BigEndianKey(LegacyOSMIdComparator::ToId(iterator->key())).ToSlice(), value);
+
+		numBytesInBatch += value.size();
+		if (numBytesInBatch > WriteBatchSize)
+		{
+			status = migratedDB->Write(wo, &writeBatch);
+			writeBatch.Clear();
+			numBytesInBatch = 0;
+		}
+	}
+	if (status.ok())
+	{
+		status = iterator->status();
+	}
+	if (status.ok())
+	{
+		status = migratedDB->Write(wo, &writeBatch);
+	}
+	delete iterator;
+	delete legacyDB;
+	delete migratedDB;
+
+	if (!status.ok())
+	{
+		leveldb::DestroyDB(migratedFilePath, options);
+		return status;
+	}
+
+	leveldb::DestroyDB(filePath, legacyOptions);
+	if (rename(migratedFilePath.c_str(), filePath.c_str()) != 0)
+	{
+		return leveldb::Status::IOError(filePath, "could not replace database with migrated one");
+	}
+
+	return leveldb::DB::Open(options, filePath, db);
+}
+
+#endif // __LEVELDBKEYS_H__
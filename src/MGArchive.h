@@ -1,15 +1,24 @@
 #ifndef __MGARCHIVE_H__
 #define __MGARCHIVE_H__
 
-#include <sstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 using namespace std;
 
+// Saving archives write into a growable contiguous buffer.
+// Loading archives read through a bounds-checked cursor directly from the memory they were given (no copy),
+// so that memory has to outlive the archive.
 class MGArchive
 {
 protected:
-	stringstream m_s;
+	vector<char> m_buffer;
+	const char* m_cursor;
+	const char* m_end;
 
 private:
 	bool m_isLoading;
@@ -19,42 +28,28 @@ public:
 	/**************************** CTOR ****************************/
 
 	MGArchive()
-		: m_s("", ios_base::in | ios_base::out | ios_base::binary)
+		: m_cursor(NULL)
+		, m_end(NULL)
 		, m_isLoading(false)
 		, m_isSaving(true)
 	{
 	}
 
 	MGArchive(const char* data, unsigned int size)
-		: m_s("", ios_base::in | ios_base::out | ios_base::binary)
+		: m_cursor(data)
+		, m_end(data + size)
 		, m_isLoading(true)
 		, m_isSaving(false)
 	{
-		m_s.write(data, size);
-		m_s.seekg(0);
 	}
 
+	// loads what has been saved to ar (ar must outlive this archive)
 	MGArchive(MGArchive& ar)
-		: m_s("", ios_base::in | ios_base::out | ios_base::binary)
+		: m_cursor(ar.m_buffer.data())
+		, m_end(ar.m_buffer.data() + ar.m_buffer.size())
 		, m_isLoading(true)
 		, m_isSaving(false)
 	{
-		// TODO: Find non-intrusive method
-		ar.m_s.seekg(0, ios_base::end);
-		const int size = (int)ar.m_s.tellg();
-
-		char *tempBuffer = new char[size];
-
-		// Read original data
-		ar.m_s.seekg(0);
-		ar.m_s.read(tempBuffer, size);
-
-		// Write to stream
-		m_s.seekp(0);
-		m_s.write(tempBuffer, size);
-
-		// Delete temp
-		delete tempBuffer;
 	}
 
 	/**************************** GETTER ****************************/
@@ -62,33 +57,67 @@ public:
 	bool IsLoading() const { return m_isLoading; };
 	bool IsSaving() const { return m_isSaving; };
 
+	const char* GetData() const { return m_buffer.data(); }
+	uint64_t GetSize() const { return m_buffer.size(); }
+
+	// number of bytes not yet read by a loading archive
+	uint64_t GetNumBytesLeft() const { return m_end - m_cursor; }
+
 	char* ToByteStream(uint64_t& size)
 	{
-		// Size determination
-		m_s.seekg(0, ios_base::end);
-		size = (uint64_t)m_s.tellg();
+		size = m_buffer.size();
 
 		char* result = new char[size];
-		m_s.seekg(0);
-
-		m_s.read(result, size);
+		memcpy(result, m_buffer.data(), size);
 
 		return result;
 	}
 
+	// discards saved data but keeps the allocated buffer for reuse
+	void Clear()
+	{
+		assert(m_isSaving);
+		m_buffer.clear();
+	}
+
 	/**************************** WRITING ****************************/
 	template <typename T>
 	void Serialize(const T& value)
 	{
 		assert(m_isSaving);
 
-		m_s.write((char*)&value, sizeof(T));
+		Serialize((const char*)&value, sizeof(T));
 	}
 
 	void Serialize(const char* data, const uint64_t size)
 	{
 		assert(m_isSaving);
-		m_s.write(data, size);
+
+		const size_t offset = m_buffer.size();
+		m_buffer.resize(offset + (size_t)size);
+		memcpy(m_buffer.data() + offset, data, (size_t)size);
+	}
+
+	// 7 bits per byte, least significant group first (protobuf style)
+	void SerializeVarUInt(uint64_t value)
+	{
+		assert(m_isSaving);
+
+		char bytes[10];
+		int numBytes = 0;
+		while (value >= 0x80)
+		{
+			bytes[numBytes++] = (char)(value | 0x80);
+			value >>= 7;
+		}
+		bytes[numBytes++] = (char)value;
+		Serialize((const char*)bytes, numBytes);
+	}
+
+	// zigzag encoded, small absolute values take few bytes
+	void SerializeVarInt(const int64_t value)
+	{
+		SerializeVarUInt(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
 	}
 
 	/**************************** LOADING ****************************/
@@ -98,15 +127,49 @@ public:
 		assert(m_isLoading);
 
 		T result;
-		m_s.read((char*)&result, sizeof(T));
+		Serialize((char*)&result, sizeof(T));
 
 		return result;
 	}
 
 	void Serialize(char* data, const uint64_t& size)
+	{
+		memcpy(data, Skip(size), (size_t)size);
+	}
+
+	uint64_t SerializeVarUInt()
+	{
+		assert(m_isLoading);
+
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			const uint8_t b = (uint8_t)*Skip(1);
+			value |= (uint64_t)(b & 0x7F) << shift;
+			if ((b & 0x80) == 0) return value;
+		}
+		throw std::runtime_error("MGArchive: malformed varint");
+	}
+
+	int64_t SerializeVarInt()
+	{
+		const uint64_t zigzag = SerializeVarUInt();
+		return (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+	}
+
+	// advances the cursor without copying and returns the skipped data
+	const char* Skip(const uint64_t& size)
 	{
 		assert(m_isLoading);
-		m_s.read(data, size);
+
+		if (size > (uint64_t)(m_end - m_cursor))
+		{
+			throw std::out_of_range("MGArchive: read beyond end of data");
+		}
+
+		const char* data = m_cursor;
+		m_cursor += size;
+		return data;
 	}
 };
 
@@ -125,13 +188,12 @@ MGArchive& operator<<(MGArchive& archive, T& value)
 }
 
 template<>
-MGArchive& operator<<(MGArchive& archive, std::string& value)
+inline MGArchive& operator<<(MGArchive& archive, std::string& value)
 {
 	if (archive.IsLoading())
 	{
 		uint64_t length = archive.Serialize<uint64_t>();
-		value.resize(length);
-		archive.Serialize(&value.front(), length);
+		value.assign(archive.Skip(length), (size_t)length);
 	}
 	else
 	{
@@ -142,4 +204,4 @@ MGArchive& operator<<(MGArchive& archive, std::string& value)
 	return archive;
 }
 
-#endif // __MGARCHIVE_H__
\ No newline at end of file
+#endif // __MGARCHIVE_H__
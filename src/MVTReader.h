@@ -0,0 +1,554 @@
+#ifndef __MVTREADER_H__
+#define __MVTREADER_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Lazy decoder of Mapbox vector tiles reading the protobuf wire format in place (e.g. a file buffer or mapping),
+// without building vector_tile::Tile messages. Names, keys and string values point into the tile data, which has to
+// outlive the reader. Geometry is decoded command by command into caller provided buffers, nothing is allocated
+// by the reader itself.
+// Truncated or malformed data ends the iteration and makes IsValid() return false.
+//
+// MVTReader reader(data, size);
+// MVTLayer layer;
+// while (reader.NextLayer(layer))
+// {
+//     MVTFeature feature;
+//     while (layer.NextFeature(feature)) ...
+// }
+
+// Cursor over wire format bytes
+class MVTWireCursor
+{
+public:
+	enum WireType
+	{
+		WireTypeVarint = 0,
+		WireTypeFixed64 = 1,
+		WireTypeLengthDelimited = 2,
+		WireTypeFixed32 = 5,
+	};
+
+	MVTWireCursor()
+		: pos(NULL)
+		, end(NULL)
+		, isValid(true)
+	{
+	}
+
+	MVTWireCursor(const uint8_t* begin, const uint8_t* end)
+		: pos(begin)
+		, end(end)
+		, isValid(true)
+	{
+	}
+
+	bool IsAtEnd() const { return pos >= end; }
+	bool IsValid() const { return isValid; }
+
+	bool ReadVarint(uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64 && pos < end; shift += 7)
+		{
+			const uint8_t byte = *pos++;
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (byte < 0x80) return true;
+		}
+		return Fail();
+	}
+
+	bool ReadVarint32(uint32_t& value)
+	{
+		uint64_t value64;
+		if (!ReadVarint(value64)) return false;
+		value = (uint32_t)value64;
+		return true;
+	}
+
+	bool ReadTag(uint32_t& field, uint32_t& wireType)
+	{
+		uint32_t tag;
+		if (!ReadVarint32(tag)) return false;
+		field = tag >> 3;
+		wireType = tag & 7;
+		return true;
+	}
+
+	bool ReadLengthDelimited(const uint8_t*& begin, uint32_t& length)
+	{
+		if (!ReadVarint32(length)) return false;
+		if (length > (size_t)(end - pos)) return Fail();
+		begin = pos;
+		pos += length;
+		return true;
+	}
+
+	bool ReadFixed(void* value, const size_t size)
+	{
+		if (size > (size_t)(end - pos)) return Fail();
+		memcpy(value, pos, size); // little-endian hosts only (as the rest of the indexer)
+		pos += size;
+		return true;
+	}
+
+	bool Skip(const uint32_t wireType)
+	{
+		uint64_t varint;
+		const uint8_t* begin;
+		uint32_t length;
+		switch (wireType)
+		{
+		case WireTypeVarint: return ReadVarint(varint);
+		case WireTypeFixed64: return SkipBytes(8);
+		case WireTypeLengthDelimited: return ReadLengthDelimited(begin, length);
+		case WireTypeFixed32: return SkipBytes(4);
+		default: return Fail();
+		}
+	}
+
+private:
+	bool SkipBytes(const size_t size)
+	{
+		if (size > (size_t)(end - pos)) return Fail();
+		pos += size;
+		return true;
+	}
+
+	bool Fail()
+	{
+		pos = end;
+		isValid = false;
+		return false;
+	}
+
+	const uint8_t* pos;
+	const uint8_t* end;
+	bool isValid;
+};
+
+// Packed repeated uint32 field (feature tags and geometry), iterated by copy:
+// MVTPackedUint32 tags = feature.tags; while (tags.Next(key) && tags.Next(value)) ...
+class MVTPackedUint32
+{
+public:
+	MVTPackedUint32()
+		: begin(NULL)
+		, end(NULL)
+	{
+	}
+
+	MVTPackedUint32(const uint8_t* begin, const uint8_t* end)
+		: begin(begin)
+		, end(end)
+		, cursor(begin, end)
+	{
+	}
+
+	// every varint ends with a byte below 0x80
+	uint32_t GetNumValues() const
+	{
+		uint32_t numValues = 0;
+		for (const uint8_t* b = begin; b < end; b++)
+		{
+			numValues += *b < 0x80;
+		}
+		return numValues;
+	}
+
+	bool Next(uint32_t& value)
+	{
+		if (cursor.IsAtEnd()) return false;
+		return cursor.ReadVarint32(value);
+	}
+
+	bool IsValid() const { return cursor.IsValid(); }
+
+private:
+	const uint8_t* begin;
+	const uint8_t* end;
+	MVTWireCursor cursor;
+};
+
+struct MVTValue
+{
+	enum Type
+	{
+		TypeNull,
+		TypeString,
+		TypeFloat,
+		TypeDouble,
+		TypeInt,
+		TypeUInt,
+		TypeSInt,
+		TypeBool,
+	};
+
+	Type type;
+	const char* stringValue;
+	uint32_t stringLength;
+	float floatValue;
+	double doubleValue;
+	int64_t intValue; // int and sint
+	uint64_t uintValue;
+	bool boolValue;
+
+	std::string GetString() const { return std::string(stringValue, stringLength); }
+};
+
+struct MVTFeature
+{
+	uint64_t id;
+	uint32_t type; // vector_tile::Tile_GeomType
+	MVTPackedUint32 tags; // pairs of key and value indices
+	MVTPackedUint32 geometry;
+};
+
+class MVTLayer
+{
+	// field numbers of vector_tile.proto
+	static const uint32_t LayerName = 1;
+	static const uint32_t LayerFeatures = 2;
+	static const uint32_t LayerKeys = 3;
+	static const uint32_t LayerValues = 4;
+	static const uint32_t LayerExtent = 5;
+	static const uint32_t LayerVersion = 15;
+	static const uint32_t FeatureId = 1;
+	static const uint32_t FeatureTags = 2;
+	static const uint32_t FeatureType = 3;
+	static const uint32_t FeatureGeometry = 4;
+
+public:
+	const char* name;
+	uint32_t nameLength;
+	uint32_t extent;
+	uint32_t version;
+	uint32_t numFeatures;
+	uint32_t numKeys;
+	uint32_t numValues;
+
+	MVTLayer()
+		: name(NULL)
+		, nameLength(0)
+		, extent(4096)
+		, version(1)
+		, numFeatures(0)
+		, numKeys(0)
+		, numValues(0)
+		, isValid(true)
+	{
+	}
+
+	std::string GetName() const { return std::string(name, nameLength); }
+
+	// scans the fields of the layer once, features, keys and values are decoded when iterated
+	bool Parse(const uint8_t* begin, const uint32_t length)
+	{
+		*this = MVTLayer();
+		body = MVTWireCursor(begin, begin + length);
+
+		MVTWireCursor cursor = body;
+		uint32_t field, wireType;
+		while (!cursor.IsAtEnd() && cursor.ReadTag(field, wireType))
+		{
+			const uint8_t* bytes;
+			uint32_t numBytes;
+			if (field == LayerName && wireType == MVTWireCursor::WireTypeLengthDelimited)
+			{
+				if (!cursor.ReadLengthDelimited(bytes, numBytes)) break;
+				name = (const char*)bytes;
+				nameLength = numBytes;
+			}
+			else if (field == LayerExtent && wireType == MVTWireCursor::WireTypeVarint)
+			{
+				cursor.ReadVarint32(extent);
+			}
+			else if (field == LayerVersion && wireType == MVTWireCursor::WireTypeVarint)
+			{
+				cursor.ReadVarint32(version);
+			}
+			else
+			{
+				numFeatures += field == LayerFeatures;
+				numKeys += field == LayerKeys;
+				numValues += field == LayerValues;
+				cursor.Skip(wireType);
+			}
+		}
+
+		isValid = cursor.IsValid();
+		Rewind();
+		return isValid;
+	}
+
+	// restarts the feature, key and value iterations
+	void Rewind()
+	{
+		features = body;
+		keys = body;
+		values = body;
+	}
+
+	bool NextFeature(MVTFeature& feature)
+	{
+		const uint8_t* bytes;
+		uint32_t numBytes;
+		if (!NextField(features, LayerFeatures, bytes, numBytes)) return false;
+
+		feature.id = 0;
+		feature.type = 0;
+		feature.tags = MVTPackedUint32();
+		feature.geometry = MVTPackedUint32();
+
+		MVTWireCursor cursor(bytes, bytes + numBytes);
+		uint32_t field, wireType;
+		while (!cursor.IsAtEnd() && cursor.ReadTag(field, wireType))
+		{
+			if (field == FeatureId && wireType == MVTWireCursor::WireTypeVarint)
+			{
+				cursor.ReadVarint(feature.id);
+			}
+			else if (field == FeatureType && wireType == MVTWireCursor::WireTypeVarint)
+			{
+				cursor.ReadVarint32(feature.type);
+			}
+			else if ((field == FeatureTags || field == FeatureGeometry) && wireType == MVTWireCursor::WireTypeLengthDelimited)
+			{
+				const uint8_t* packed;
+				uint32_t packedLength;
+				if (!cursor.ReadLengthDelimited(packed, packedLength)) break;
+				(field == FeatureTags ? feature.tags : feature.geometry) = MVTPackedUint32(packed, packed + packedLength);
+			}
+			else
+			{
+				cursor.Skip(wireType);
+			}
+		}
+
+		return Check(cursor);
+	}
+
+	bool NextKey(const char*& key, uint32_t& keyLength)
+	{
+		const uint8_t* bytes;
+		if (!NextField(keys, LayerKeys, bytes, keyLength)) return false;
+		key = (const char*)bytes;
+		return true;
+	}
+
+	bool NextValue(MVTValue& value)
+	{
+		const uint8_t* bytes;
+		uint32_t numBytes;
+		if (!NextField(values, LayerValues, bytes, numBytes)) return false;
+
+		memset(&value, 0, sizeof(value));
+		value.type = MVTValue::TypeNull;
+
+		MVTWireCursor cursor(bytes, bytes + numBytes);
+		uint32_t field, wireType;
+		uint64_t varint;
+		while (!cursor.IsAtEnd() && cursor.ReadTag(field, wireType))
+		{
+			switch (field)
+			{
+			case 1:
+				if (wireType != MVTWireCursor::WireTypeLengthDelimited || !cursor.ReadLengthDelimited(bytes, value.stringLength)) break;
+				value.stringValue = (const char*)bytes;
+				value.type = MVTValue::TypeString;
+				continue;
+			case 2:
+				if (wireType != MVTWireCursor::WireTypeFixed32 || !cursor.ReadFixed(&value.floatValue, sizeof(float))) break;
+				value.type = MVTValue::TypeFloat;
+				continue;
+			case 3:
+				if (wireType != MVTWireCursor::WireTypeFixed64 || !cursor.ReadFixed(&value.doubleValue, sizeof(double))) break;
+				value.type = MVTValue::TypeDouble;
+				continue;
+			case 4:
+			case 5:
+			case 6:
+			case 7:
+				if (wireType != MVTWireCursor::WireTypeVarint || !cursor.ReadVarint(varint)) break;
+				if (field == 4) value.intValue = (int64_t)varint;
+				if (field == 5) value.uintValue = varint;
+				if (field == 6) value.intValue = (int64_t)(varint >> 1) ^ -(int64_t)(varint & 1);
+				if (field == 7) value.boolValue = varint != 0;
+				value.type = field == 4 ? MVTValue::TypeInt : field == 5 ? MVTValue::TypeUInt : field == 6 ? MVTValue::TypeSInt : MVTValue::TypeBool;
+				continue;
+			}
+			if (!cursor.IsValid() || !cursor.Skip(wireType)) break;
+		}
+
+		return Check(cursor);
+	}
+
+	bool IsValid() const { return isValid; }
+
+private:
+	bool NextField(MVTWireCursor& cursor, const uint32_t wantedField, const uint8_t*& bytes, uint32_t& numBytes)
+	{
+		uint32_t field, wireType;
+		while (!cursor.IsAtEnd() && cursor.ReadTag(field, wireType))
+		{
+			if (field == wantedField && wireType == MVTWireCursor::WireTypeLengthDelimited)
+			{
+				if (cursor.ReadLengthDelimited(bytes, numBytes)) return true;
+				break;
+			}
+			cursor.Skip(wireType);
+		}
+		Check(cursor);
+		return false;
+	}
+
+	bool Check(const MVTWireCursor& cursor)
+	{
+		if (!cursor.IsValid()) isValid = false;
+		return cursor.IsValid();
+	}
+
+	MVTWireCursor body;
+	MVTWireCursor features;
+	MVTWireCursor keys;
+	MVTWireCursor values;
+	bool isValid;
+};
+
+class MVTReader
+{
+	static const uint32_t TileLayers = 3;
+
+public:
+	MVTReader(const void* data, const size_t size)
+		: cursor((const uint8_t*)data, (const uint8_t*)data + size)
+		, isValid(true)
+	{
+	}
+
+	// number of layers not iterated yet (skips over them without parsing)
+	uint32_t GetNumLayers() const
+	{
+		MVTWireCursor layers = cursor;
+		uint32_t numLayers = 0;
+		uint32_t field, wireType;
+		while (!layers.IsAtEnd() && layers.ReadTag(field, wireType) && layers.Skip(wireType))
+		{
+			numLayers += field == TileLayers;
+		}
+		return numLayers;
+	}
+
+	bool NextLayer(MVTLayer& layer)
+	{
+		uint32_t field, wireType;
+		while (!cursor.IsAtEnd() && cursor.ReadTag(field, wireType))
+		{
+			if (field == TileLayers && wireType == MVTWireCursor::WireTypeLengthDelimited)
+			{
+				const uint8_t* bytes;
+				uint32_t numBytes;
+				if (!cursor.ReadLengthDelimited(bytes, numBytes)) break;
+				if (layer.Parse(bytes, numBytes)) return true;
+
+				isValid = false;
+				return false;
+			}
+			cursor.Skip(wireType);
+		}
+		if (!cursor.IsValid()) isValid = false;
+		return false;
+	}
+
+	bool IsValid() const { return isValid; }
+
+private:
+	MVTWireCursor cursor;
+	bool isValid;
+};
+
+// Structure of arrays the geometry of a feature is decoded into. Each MoveTo vertex starts a new part
+// (ring, line string or point). Meant to be reused between features, so it only allocates while growing.
+struct MVTGeometryBuffers
+{
+	std::vector<int32_t> x;
+	std::vector<int32_t> y;
+	std::vector<uint32_t> partStarts; // index of the first vertex of each part
+
+	void Clear()
+	{
+		x.clear();
+		y.clear();
+		partStarts.clear();
+	}
+
+	void BeginPart() { partStarts.push_back((uint32_t)x.size()); }
+
+	void AddVertex(const int32_t vertexX, const int32_t vertexY)
+	{
+		x.push_back(vertexX);
+		y.push_back(vertexY);
+	}
+
+	uint32_t GetNumParts() const { return (uint32_t)partStarts.size(); }
+	uint32_t GetPartBegin(const uint32_t part) const { return partStarts[part]; }
+	uint32_t GetPartEnd(const uint32_t part) const { return part + 1 < partStarts.size() ? partStarts[part + 1] : (uint32_t)x.size(); }
+};
+
+// Iterates the commands of a feature geometry, vertices are returned as absolute tile coordinates.
+// MVTGeometryReader geometry(feature.geometry);
+// while (geometry.NextCommand(command, count))
+//     for (uint32_t v = 0; command != ClosePath && v < count && geometry.NextVertex(x, y); v++) ...
+class MVTGeometryReader
+{
+public:
+	MVTGeometryReader(const MVTPackedUint32& geometry)
+		: geometry(geometry)
+		, cursorX(0)
+		, cursorY(0)
+		, isValid(true)
+	{
+	}
+
+	bool NextCommand(uint32_t& command, uint32_t& count)
+	{
+		uint32_t commandAndCount;
+		if (!geometry.Next(commandAndCount)) return false;
+		command = commandAndCount & 7;
+		count = commandAndCount >> 3;
+		return true;
+	}
+
+	bool NextVertex(int32_t& x, int32_t& y)
+	{
+		uint32_t xZigZag, yZigZag;
+		if (!geometry.Next(xZigZag) || !geometry.Next(yZigZag))
+		{
+			isValid = false;
+			return false;
+		}
+		cursorX += ZigZagDecode(xZigZag);
+		cursorY += ZigZagDecode(yZigZag);
+		x = cursorX;
+		y = cursorY;
+		return true;
+	}
+
+	bool IsValid() const { return isValid && geometry.IsValid(); }
+
+private:
+	static int32_t ZigZagDecode(const uint32_t zigzag)
+	{
+		return (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+	}
+
+	MVTPackedUint32 geometry;
+	int32_t cursorX;
+	int32_t cursorY;
+	bool isValid;
+};
+
+#endif // __MVTREADER_H__
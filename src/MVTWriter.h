@@ -0,0 +1,201 @@
+#ifndef __MVTWRITER_H__
+#define __MVTWRITER_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "vector_tile.pb.h"
+
+// Writes Mapbox vector tiles in protobuf wire format straight into a reusable buffer, without building
+// vector_tile::Tile messages. Fields are written in field number order like the generated serializer does,
+// so for the same content the output is byte identical to vector_tile::Tile::SerializeToString().
+// Layers are length prefixed, their length is patched in by EndLayer().
+//
+// writer.Clear();
+// writer.BeginLayer("roads");
+// writer.AddFeature(id, tags, numTags, vector_tile::Tile_GeomType_LINESTRING, geometry, numGeometry);
+// writer.EndLayer(keys, values, 4096);
+class MVTWriter
+{
+	enum WireType
+	{
+		WireTypeVarint = 0,
+		WireTypeLengthDelimited = 2,
+	};
+
+	// field numbers of vector_tile.proto
+	static const uint32_t TileLayers = 3;
+	static const uint32_t LayerName = 1;
+	static const uint32_t LayerFeatures = 2;
+	static const uint32_t LayerKeys = 3;
+	static const uint32_t LayerValues = 4;
+	static const uint32_t LayerExtent = 5;
+	static const uint32_t LayerVersion = 15;
+	static const uint32_t FeatureId = 1;
+	static const uint32_t FeatureTags = 2;
+	static const uint32_t FeatureType = 3;
+	static const uint32_t FeatureGeometry = 4;
+	static const uint32_t ValueString = 1;
+
+	static const size_t MaxVarintSize = 10;
+	static const size_t LayerLengthReserve = 5; // varint32
+
+public:
+	MVTWriter()
+		: layerStart(0)
+	{
+	}
+
+	// discards the tile but keeps the allocated buffer
+	void Clear()
+	{
+		buffer.clear();
+	}
+
+	void BeginLayer(const std::string& name)
+	{
+		WriteTag(TileLayers, WireTypeLengthDelimited);
+		layerStart = buffer.size();
+		buffer.resize(buffer.size() + LayerLengthReserve);
+
+		WriteString(LayerName, name);
+	}
+
+	void AddFeature(const uint64_t id, const uint32_t* tags, const uint32_t numTags,
+		const vector_tile::Tile_GeomType type, const uint32_t* geometry, const uint32_t numGeometry)
+	{
+		const uint32_t tagsSize = GetPackedSize(tags, numTags);
+		const uint32_t geometrySize = GetPackedSize(geometry, numGeometry);
+
+		uint32_t featureSize = 1 + GetVarintSize(id) + 1 + GetVarintSize((uint32_t)type);
+		if (numTags > 0) featureSize += 1 + GetVarintSize(tagsSize) + tagsSize;
+		if (numGeometry > 0) featureSize += 1 + GetVarintSize(geometrySize) + geometrySize;
+
+		Reserve(1 + MaxVarintSize + featureSize);
+
+		WriteTag(LayerFeatures, WireTypeLengthDelimited);
+		WriteVarint(featureSize);
+
+		WriteTag(FeatureId, WireTypeVarint);
+		WriteVarint(id);
+		WritePacked(FeatureTags, tags, numTags, tagsSize);
+		WriteTag(FeatureType, WireTypeVarint);
+		WriteVarint((uint32_t)type);
+		WritePacked(FeatureGeometry, geometry, numGeometry, geometrySize);
+	}
+
+	void EndLayer(const std::vector<std::string>& keys, const std::vector<std::string>& values, const uint32_t extent, const uint32_t version = 2)
+	{
+		for (const auto& key : keys)
+		{
+			WriteString(LayerKeys, key);
+		}
+
+		for (const auto& value : values)
+		{
+			const uint32_t valueSize = 1 + GetVarintSize((uint32_t)value.size()) + (uint32_t)value.size();
+			WriteTag(LayerValues, WireTypeLengthDelimited);
+			WriteVarint(valueSize);
+			WriteString(ValueString, value);
+		}
+
+		WriteTag(LayerExtent, WireTypeVarint);
+		WriteVarint(extent);
+		WriteTag(LayerVersion, WireTypeVarint);
+		WriteVarint(version);
+
+		// patch in the layer length and move the layer body to close the gap left by the reserved bytes
+		const size_t bodyStart = layerStart + LayerLengthReserve;
+		const uint32_t layerSize = (uint32_t)(buffer.size() - bodyStart);
+		const uint32_t lengthSize = GetVarintSize(layerSize);
+
+		memmove(&buffer[layerStart + lengthSize], &buffer[bodyStart], layerSize);
+		buffer.resize(layerStart + lengthSize + layerSize);
+
+		EncodeVarint(layerSize, &buffer[layerStart]);
+	}
+
+	const char* GetData() const { return buffer.data(); }
+	size_t GetSize() const { return buffer.size(); }
+
+private:
+	static uint32_t GetVarintSize(uint64_t value)
+	{
+		uint32_t size = 1;
+		while (value >= 0x80)
+		{
+			value >>= 7;
+			size++;
+		}
+		return size;
+	}
+
+	static uint32_t GetPackedSize(const uint32_t* values, const uint32_t numValues)
+	{
+		uint32_t size = 0;
+		for (uint32_t v = 0; v < numValues; v++)
+		{
+			size += GetVarintSize(values[v]);
+		}
+		return size;
+	}
+
+	void Reserve(const size_t numBytes)
+	{
+		if (buffer.capacity() < buffer.size() + numBytes)
+		{
+			buffer.reserve(std::max(buffer.capacity() * 2, buffer.size() + numBytes));
+		}
+	}
+
+	static int EncodeVarint(uint64_t value, char* bytes)
+	{
+		int numBytes = 0;
+		while (value >= 0x80)
+		{
+			bytes[numBytes++] = (char)(value | 0x80);
+			value >>= 7;
+		}
+		bytes[numBytes++] = (char)value;
+		return numBytes;
+	}
+
+	void WriteVarint(const uint64_t value)
+	{
+		char bytes[MaxVarintSize];
+		const int numBytes = EncodeVarint(value, bytes);
+		buffer.insert(buffer.end(), bytes, bytes + numBytes);
+	}
+
+	void WriteTag(const uint32_t field, const WireType wireType)
+	{
+		WriteVarint((field << 3) | wireType);
+	}
+
+	void WriteString(const uint32_t field, const std::string& s)
+	{
+		WriteTag(field, WireTypeLengthDelimited);
+		WriteVarint(s.size());
+		buffer.insert(buffer.end(), s.begin(), s.end());
+	}
+
+	void WritePacked(const uint32_t field, const uint32_t* values, const uint32_t numValues, const uint32_t size)
+	{
+		if (numValues == 0) return;
+
+		WriteTag(field, WireTypeLengthDelimited);
+		WriteVarint(size);
+		for (uint32_t v = 0; v < numValues; v++)
+		{
+			WriteVarint(values[v]);
+		}
+	}
+
+	std::vector<char> buffer;
+	size_t layerStart;
+};
+
+#endif // __MVTWRITER_H__
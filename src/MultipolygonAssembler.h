@@ -0,0 +1,257 @@
+#ifndef __MULTIPOLYGONASSEMBLER_H__
+#define __MULTIPOLYGONASSEMBLER_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+
+#include <ZFXMath.h>
+
+#include "o5mindexer.h"
+#include "WayCodec.h"
+#include "WayStore.h"
+
+// Areas assembled from a relation get ids of their own, so they don't collide with way ids in the index and way store.
+// Each outer ring (together with its holes) becomes one area.
+const uint64_t RelationAreaIdFlag = 1ull << 62;
+const int RelationAreaOuterRingBits = 16;
+
+inline uint64_t GetRelationAreaId(const uint64_t relationId, const uint32_t outerRingIndex)
+{
+	return RelationAreaIdFlag | (relationId << RelationAreaOuterRingBits) | outerRingIndex;
+}
+
+inline bool IsRelationAreaId(const uint64_t id)
+{
+	return (id & RelationAreaIdFlag) != 0;
+}
+
+inline bool IsMultipolygonRelation(const std::vector<Tag>& tags)
+{
+	for (const auto& tag : tags)
+	{
+		if (tag.key == "type") return tag.value == "multipolygon";
+	}
+	return false;
+}
+
+struct RelationMember
+{
+	uint64_t wayId;
+	bool isInner;
+};
+
+// Assembles the areas of a multipolygon relation from the geometry of its member ways in the WayStore.
+// Member ways are stitched into closed rings at shared end points, inner rings are assigned to the smallest outer ring
+// containing them and all rings are oriented as the Polygon class of the tile renderer expects
+// (outer rings: ComputeArea() <= 0, inner rings: ComputeArea() >= 0).
+// Only one relation is held in memory at a time, buffers are reused between relations.
+class MultipolygonAssembler
+{
+	typedef ZFXMath::TPolygon2D<int32_t> Ring;
+	typedef ZFXMath::TVector2D<int32_t> Vertex;
+
+public:
+	MultipolygonAssembler(const WayStore& wayStore, const TagDictionary& tagDictionary)
+		: wayStore(wayStore)
+		, tagDictionary(tagDictionary)
+	{
+	}
+
+	// false if the relation is incomplete (missing member ways or rings which can't be closed)
+	bool Assemble(const uint64_t relationId, const std::vector<RelationMember>& members, const std::vector<Tag>& tags, std::vector<Way>& areas)
+	{
+		areas.clear();
+
+		std::vector<Ring> outerRings;
+		std::vector<Ring> innerRings;
+		if (!StitchRings(members, false, outerRings) || !StitchRings(members, true, innerRings)) return false;
+		if (outerRings.empty() || outerRings.size() > (1u << RelationAreaOuterRingBits)) return false;
+
+		areas.resize(outerRings.size());
+		for (size_t o = 0; o < outerRings.size(); o++)
+		{
+			Way& area = areas[o];
+			area.id = GetRelationAreaId(relationId, (uint32_t)o);
+			area.tags = tags;
+			area.polygon = std::move(outerRings[o]);
+			area.innerRings.clear();
+			Orient(area.polygon, false);
+			area.bbox = ComputeBBox(area.polygon);
+		}
+
+		for (auto& innerRing : innerRings)
+		{
+			const Vertex& vertex = innerRing.GetVertices()[0];
+
+			Way* container = NULL;
+			double containerArea = std::numeric_limits<double>::max();
+			for (auto& area : areas)
+			{
+				const double outerArea = -ComputeArea(area.polygon);
+				if (outerArea < containerArea && IsInside(area.bbox, vertex) && IsInside(area.polygon, vertex))
+				{
+					container = &area;
+					containerArea = outerArea;
+				}
+			}
+			if (container == NULL) continue; // hole outside of every outer ring (broken relation)
+
+			Orient(innerRing, true);
+			container->innerRings.push_back(std::move(innerRing));
+		}
+
+		return true;
+	}
+
+private:
+	// stitches all members of the given role into closed rings
+	bool StitchRings(const std::vector<RelationMember>& members, const bool inner, std::vector<Ring>& rings)
+	{
+		segments.clear();
+		for (const auto& member : members)
+		{
+			if (member.isInner != inner) continue;
+			if (!wayStore.Get(member.wayId, record)) return false;
+
+			segments.push_back(std::vector<Vertex>());
+			Ring geometry;
+			WayRecordView(record.data(), (uint32_t)record.size(), tagDictionary).DecodeGeometry(geometry);
+			segments.back().assign(geometry.GetVertices(), geometry.GetVertices() + geometry.GetNumVertices());
+			if (segments.back().size() < 2) segments.pop_back();
+		}
+
+		endpoints.clear();
+		for (size_t s = 0; s < segments.size(); s++)
+		{
+			endpoints.insert(std::make_pair(GetVertexKey(segments[s].front()), s));
+			endpoints.insert(std::make_pair(GetVertexKey(segments[s].back()), s));
+		}
+		isSegmentUsed.assign(segments.size(), false);
+
+		for (size_t s = 0; s < segments.size(); s++)
+		{
+			if (isSegmentUsed[s]) continue;
+			isSegmentUsed[s] = true;
+
+			ring.assign(segments[s].begin(), segments[s].end());
+			while (GetVertexKey(ring.front()) != GetVertexKey(ring.back()))
+			{
+				const size_t next = FindUnusedSegment(GetVertexKey(ring.back()));
+				if (next == SIZE_MAX) return false; // open ring
+
+				isSegmentUsed[next] = true;
+				const std::vector<Vertex>& segment = segments[next];
+				if (GetVertexKey(segment.front()) == GetVertexKey(ring.back()))
+				{
+					ring.insert(ring.end(), segment.begin() + 1, segment.end());
+				}
+				else
+				{
+					ring.insert(ring.end(), segment.rbegin() + 1, segment.rend());
+				}
+			}
+
+			if (ring.size() < 4) continue; // degenerated ring
+
+			rings.push_back(Ring());
+			rings.back().SetNumVertices((int)ring.size());
+			std::copy(ring.begin(), ring.end(), rings.back().GetVertices());
+		}
+		return true;
+	}
+
+	size_t FindUnusedSegment(const uint64_t vertexKey) const
+	{
+		auto range = endpoints.equal_range(vertexKey);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (!isSegmentUsed[it->second]) return it->second;
+		}
+		return SIZE_MAX;
+	}
+
+	static uint64_t GetVertexKey(const Vertex& vertex)
+	{
+		return ((uint64_t)(uint32_t)vertex.x << 32) | (uint32_t)vertex.y;
+	}
+
+	// same sign as Ring::ComputeArea(), but relative to the first vertex and accumulated in double:
+	// the products of absolute coordinates (up to 3.6e9 * 1.8e9) overflow int64 when summed over large rings
+	static double ComputeArea(const Ring& ring)
+	{
+		const int numVertices = ring.GetNumVertices();
+		const Vertex* vertices = ring.GetVertices();
+		double area = 0.0;
+		for (int v = 1; v + 1 < numVertices; v++)
+		{
+			const double x1 = (double)((int64_t)vertices[v].x - vertices[0].x);
+			const double y1 = (double)((int64_t)vertices[v].y - vertices[0].y);
+			const double x2 = (double)((int64_t)vertices[v + 1].x - vertices[0].x);
+			const double y2 = (double)((int64_t)vertices[v + 1].y - vertices[0].y);
+			area += x1 * y2 - x2 * y1;
+		}
+		return area * 0.5;
+	}
+
+	static void Orient(Ring& ring, const bool inner)
+	{
+		const double area = ComputeArea(ring);
+		if (inner ? area < 0 : area > 0)
+		{
+			std::reverse(ring.GetVertices(), ring.GetVertices() + ring.GetNumVertices());
+		}
+	}
+
+	static BBox ComputeBBox(const Ring& ring)
+	{
+		BBox bbox;
+		bbox.minX = bbox.minY = std::numeric_limits<int32_t>::max();
+		bbox.maxX = bbox.maxY = std::numeric_limits<int32_t>::min();
+		for (int v = 0; v < ring.GetNumVertices(); v++)
+		{
+			const Vertex& vertex = ring.GetVertices()[v];
+			bbox.minX = std::min(bbox.minX, vertex.x);
+			bbox.minY = std::min(bbox.minY, vertex.y);
+			bbox.maxX = std::max(bbox.maxX, vertex.x);
+			bbox.maxY = std::max(bbox.maxY, vertex.y);
+		}
+		return bbox;
+	}
+
+	static bool IsInside(const BBox& bbox, const Vertex& vertex)
+	{
+		return vertex.x >= bbox.minX && vertex.x <= bbox.maxX && vertex.y >= bbox.minY && vertex.y <= bbox.maxY;
+	}
+
+	// even-odd rule
+	static bool IsInside(const Ring& ring, const Vertex& vertex)
+	{
+		const Vertex* vertices = ring.GetVertices();
+		const int numVertices = ring.GetNumVertices();
+		bool isInside = false;
+		for (int i = 0, j = numVertices - 1; i < numVertices; j = i++)
+		{
+			if ((vertices[i].y > vertex.y) != (vertices[j].y > vertex.y))
+			{
+				const double x = vertices[j].x + (double)(vertices[i].x - vertices[j].x) * (vertex.y - vertices[j].y) / (double)(vertices[i].y - vertices[j].y);
+				if (vertex.x < x) isInside = !isInside;
+			}
+		}
+		return isInside;
+	}
+
+	const WayStore& wayStore;
+	const TagDictionary& tagDictionary;
+
+	std::string record;
+	std::vector<std::vector<Vertex>> segments;
+	std::unordered_multimap<uint64_t, size_t> endpoints;
+	std::vector<bool> isSegmentUsed;
+	std::vector<Vertex> ring;
+};
+
+#endif // __MULTIPOLYGONASSEMBLER_H__
@@ -0,0 +1,185 @@
+#ifndef __PINNEDPAGESTORAGE_H__
+#define __PINNEDPAGESTORAGE_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <string.h>
+
+#include <spatialindex/SpatialIndex.h>
+
+// Read only view into a page held by a storage manager.
+// The page stays valid as long as the view exists, even if the page is evicted or overwritten meanwhile.
+class PinnedPage
+{
+public:
+	PinnedPage()
+	{
+	}
+
+	PinnedPage(const std::shared_ptr<const std::string>& buffer)
+		: buffer(buffer)
+	{
+	}
+
+	bool IsValid() const { return buffer != nullptr; }
+	const byte* GetData() const { return (const byte*)buffer->data(); }
+	uint32_t GetLength() const { return (uint32_t)buffer->size(); }
+
+private:
+	std::shared_ptr<const std::string> buffer;
+};
+
+// Extension of SpatialIndex::IStorageManager which hands out pinned pages instead of copies
+class IPinnedPageStorageManager
+{
+public:
+	virtual ~IPinnedPageStorageManager() {}
+
+	virtual PinnedPage loadPinnedPage(const SpatialIndex::id_type page) = 0;
+};
+
+// Entry of an R-tree leaf as stored on its page
+struct PageEntry
+{
+	SpatialIndex::id_type id;
+	const double* low;
+	const double* high;
+	const byte* data;
+	uint32_t length;
+};
+
+class IPageEntryVisitor
+{
+public:
+	virtual ~IPageEntryVisitor() {}
+
+	virtual void visitEntry(const PageEntry& entry) = 0;
+
+	// all entries of one leaf which intersect the query, override to process them in one go
+	virtual void visitEntries(const PageEntry* entries, const uint32_t numEntries)
+	{
+		for (uint32_t e = 0; e < numEntries; e++)
+		{
+			visitEntry(entries[e]);
+		}
+	}
+};
+
+// Read only R-tree query which traverses the node pages directly from pinned pages.
+// No node objects are created and no page is copied (libspatialindex's RTree::loadNode copies every page it visits).
+// Matching entries are delivered per leaf (see IPageEntryVisitor::visitEntries()).
+// The page layout has to match RTree::storeHeader() and RTree::Node::storeToByteArray() of libspatialindex.
+class PinnedRTreeQuery
+{
+public:
+	PinnedRTreeQuery(IPinnedPageStorageManager& storage, const SpatialIndex::id_type indexId)
+		: storage(storage)
+		, rootId(-1)
+		, dimension(0)
+	{
+		PinnedPage header = storage.loadPinnedPage(indexId);
+		const byte* ptr = header.GetData();
+
+		memcpy(&rootId, ptr, sizeof(SpatialIndex::id_type));
+		ptr += sizeof(SpatialIndex::id_type);
+		ptr += sizeof(SpatialIndex::RTree::RTreeVariant);	// tree variant
+		ptr += sizeof(double);								// fill factor
+		ptr += 3 * sizeof(uint32_t);						// index capacity, leaf capacity, near minimum overlap factor
+		ptr += 2 * sizeof(double);							// split distribution factor, reinsert factor
+		memcpy(&dimension, ptr, sizeof(uint32_t));
+
+		region.resize(2 * dimension);
+	}
+
+	uint32_t GetDimension() const { return dimension; }
+
+	void intersectsWithQuery(const SpatialIndex::Region& query, IPageEntryVisitor& visitor)
+	{
+		pageStack.clear();
+		pageStack.push_back(rootId);
+
+		while (!pageStack.empty())
+		{
+			const SpatialIndex::id_type pageId = pageStack.back();
+			pageStack.pop_back();
+
+			PinnedPage page = storage.loadPinnedPage(pageId);
+			const byte* ptr = page.GetData();
+
+			uint32_t nodeType, level, numChildren;
+			memcpy(&nodeType, ptr, sizeof(uint32_t));
+			ptr += sizeof(uint32_t);
+			memcpy(&level, ptr, sizeof(uint32_t));
+			ptr += sizeof(uint32_t);
+			memcpy(&numChildren, ptr, sizeof(uint32_t));
+			ptr += sizeof(uint32_t);
+
+			const bool isLeaf = (level == 0);
+			const size_t regionSize = dimension * sizeof(double);
+
+			if (isLeaf)
+			{
+				entries.resize(numChildren);
+				leafRegions.resize(numChildren * 2 * dimension);
+			}
+
+			uint32_t numEntries = 0;
+			for (uint32_t c = 0; c < numChildren; c++)
+			{
+				double* low = isLeaf ? &leafRegions[numEntries * 2 * dimension] : region.data();
+				double* high = low + dimension;
+				memcpy(low, ptr, regionSize);
+				ptr += regionSize;
+				memcpy(high, ptr, regionSize);
+				ptr += regionSize;
+
+				PageEntry entry;
+				memcpy(&entry.id, ptr, sizeof(SpatialIndex::id_type));
+				ptr += sizeof(SpatialIndex::id_type);
+				memcpy(&entry.length, ptr, sizeof(uint32_t));
+				ptr += sizeof(uint32_t);
+				entry.data = entry.length > 0 ? ptr : NULL;
+				ptr += entry.length;
+
+				if (!Intersects(query, low, high)) continue;
+
+				if (isLeaf)
+				{
+					entry.low = low;
+					entry.high = high;
+					entries[numEntries++] = entry;
+				}
+				else
+				{
+					pageStack.push_back(entry.id);
+				}
+			}
+
+			if (numEntries > 0)
+			{
+				visitor.visitEntries(entries.data(), numEntries); // page stays pinned until the visitor returns
+			}
+		}
+	}
+
+private:
+	bool Intersects(const SpatialIndex::Region& query, const double* low, const double* high) const
+	{
+		for (uint32_t d = 0; d < dimension; d++)
+		{
+			if (low[d] > query.m_pHigh[d] || high[d] < query.m_pLow[d]) return false;
+		}
+		return true;
+	}
+
+	IPinnedPageStorageManager& storage;
+	SpatialIndex::id_type rootId;
+	uint32_t dimension;
+	std::vector<SpatialIndex::id_type> pageStack;
+	std::vector<double> region;
+	std::vector<double> leafRegions;
+	std::vector<PageEntry> entries;
+};
+
+#endif // __PINNEDPAGESTORAGE_H__
@@ -0,0 +1,189 @@
+#ifndef __TAGFILTER_H__
+#define __TAGFILTER_H__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "o5mindexer.h"
+
+// Declarative filter on the tags of a way (or relation).
+// The filter is a list of clauses, it matches if any clause matches (an empty filter matches everything).
+// A clause is a comma separated list of terms which all have to match:
+//   key              key exists
+//   !key             key does not exist
+//   key=v1|v2        key exists with one of the values
+//   key!=v1|v2       key does not exist or has none of the values
+// Clauses are separated by ';' or new lines, '#' starts a comment (up to the end of the line).
+// e.g. "highway,highway!=footway|path|cycleway; building,!disused; landuse=forest|meadow"
+class TagFilter
+{
+	struct Term
+	{
+		std::string key;
+		std::vector<std::string> values; // empty: any value
+		bool isNegated;
+
+		bool Matches(const std::vector<Tag>& tags) const
+		{
+			for (const auto& tag : tags)
+			{
+				if (tag.key != key) continue;
+
+				if (values.empty()) return !isNegated;
+				for (const auto& value : values)
+				{
+					if (tag.value == value) return !isNegated;
+				}
+				return isNegated;
+			}
+			return isNegated;
+		}
+	};
+
+	typedef std::vector<Term> Clause;
+
+public:
+	TagFilter()
+	{
+	}
+
+	bool AcceptsAll() const { return clauses.empty(); }
+
+	bool Matches(const std::vector<Tag>& tags) const
+	{
+		if (AcceptsAll()) return true;
+
+		for (const auto& clause : clauses)
+		{
+			bool allTermsMatch = true;
+			for (const auto& term : clause)
+			{
+				if (!term.Matches(tags))
+				{
+					allTermsMatch = false;
+					break;
+				}
+			}
+			if (allTermsMatch) return true;
+		}
+		return false;
+	}
+
+	// replaces the filter, returns false (and leaves an empty filter) on malformed expressions, see GetError()
+	bool Parse(const std::string& expression)
+	{
+		clauses.clear();
+		error.clear();
+
+		Clause clause;
+		size_t pos = 0;
+		while (pos <= expression.size())
+		{
+			size_t end = expression.find_first_of(",;\n#", pos);
+			if (end == std::string::npos) end = expression.size();
+
+			const std::string text = Trim(expression.substr(pos, end - pos));
+			const char separator = end < expression.size() ? expression[end] : ';';
+			if (!text.empty())
+			{
+				Term term;
+				if (!ParseTerm(text, term))
+				{
+					clauses.clear();
+					error = text;
+					return false;
+				}
+				clause.push_back(term);
+			}
+
+			if (separator == '#')
+			{
+				end = expression.find('\n', end);
+				if (end == std::string::npos) end = expression.size();
+			}
+
+			if (separator != ',' && !clause.empty())
+			{
+				clauses.push_back(clause);
+				clause.clear();
+			}
+			pos = end + 1;
+		}
+		return true;
+	}
+
+	// exists is false if the file can't be opened, otherwise false is returned on malformed expressions
+	bool Load(const std::string& filePath, bool& exists)
+	{
+		FILE* f = fopen(filePath.c_str(), "r");
+		exists = f != NULL;
+		if (!f) return false;
+
+		std::string expression;
+		char buffer[4096];
+		size_t numBytesRead;
+		while ((numBytesRead = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		{
+			expression.append(buffer, numBytesRead);
+		}
+		fclose(f);
+
+		return Parse(expression);
+	}
+
+	// the malformed term of the last Parse()
+	const std::string& GetError() const { return error; }
+
+private:
+	static std::string Trim(const std::string& text)
+	{
+		const size_t first = text.find_first_not_of(" \t\r");
+		if (first == std::string::npos) return std::string();
+		const size_t last = text.find_last_not_of(" \t\r");
+		return text.substr(first, last - first + 1);
+	}
+
+	static bool ParseTerm(const std::string& text, Term& term)
+	{
+		term.isNegated = false;
+		term.values.clear();
+
+		const size_t equals = text.find('=');
+		if (equals == std::string::npos)
+		{
+			term.isNegated = text[0] == '!';
+			term.key = Trim(text.substr(term.isNegated ? 1 : 0));
+			return !term.key.empty();
+		}
+
+		size_t keyEnd = equals;
+		if (equals > 0 && text[equals - 1] == '!')
+		{
+			term.isNegated = true;
+			keyEnd--;
+		}
+		term.key = Trim(text.substr(0, keyEnd));
+		if (!term.key.empty() && term.key[0] == '!') return false; // "!key=v" is no key, "key!=v" was meant
+
+		const std::string values = text.substr(equals + 1);
+		size_t pos = 0;
+		while (pos <= values.size())
+		{
+			size_t end = values.find('|', pos);
+			if (end == std::string::npos) end = values.size();
+
+			const std::string value = Trim(values.substr(pos, end - pos));
+			if (value.empty()) return false;
+			term.values.push_back(value);
+			pos = end + 1;
+		}
+
+		return !term.key.empty();
+	}
+
+	std::vector<Clause> clauses;
+	std::string error;
+};
+
+#endif // __TAGFILTER_H__
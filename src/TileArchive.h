@@ -0,0 +1,513 @@
+#ifndef __TILEARCHIVE_H__
+#define __TILEARCHIVE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <snappy.h>
+
+#include "TileId.h"
+
+// Single file tile archive:
+//   header | tile blobs | directory
+// The directory is an array of entries sorted by tile id (zoom level, then Hilbert order, see GetTileId()),
+// readers map it and binary search it. Blobs are compressed as a whole (Snappy) or stored as they are.
+// Identical tiles (open sea, empty land) share one blob, an entry covers a run of consecutive tile ids with the same blob.
+// Empty tiles are not stored. All values are little-endian.
+
+enum TileArchiveCompression
+{
+	TileArchiveCompressionNone = 0,
+	TileArchiveCompressionSnappy = 1,
+};
+
+struct TileArchiveHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t compression;
+	uint32_t reserved;
+	uint64_t numEntries;
+	uint64_t directoryOffset;
+};
+
+struct TileArchiveEntry
+{
+	uint64_t tileId;
+	uint64_t offset;
+	uint32_t length;
+	uint32_t runLength; // tiles tileId .. tileId + runLength - 1
+};
+
+const char TileArchiveMagic[4] = { 'M', 'V', 'T', 'A' };
+const uint32_t TileArchiveVersion = 1;
+
+// 128 bit hash of the tile content (MurmurHash3_x64_128), strong enough to deduplicate tiles without comparing them
+struct TileHash
+{
+	uint64_t low;
+	uint64_t high;
+
+	bool operator==(const TileHash& other) const
+	{
+		return low == other.low && high == other.high;
+	}
+};
+
+struct TileHashHash
+{
+	size_t operator()(const TileHash& hash) const
+	{
+		return (size_t)hash.low;
+	}
+};
+
+inline uint64_t RotateLeft(const uint64_t x, const int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t MixHash(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+inline TileHash HashTile(const char* data, const size_t size)
+{
+	const uint64_t c1 = 0x87c37b91114253d5ull;
+	const uint64_t c2 = 0x4cf5ad432745937full;
+
+	uint64_t h1 = 0x9747b28c;
+	uint64_t h2 = 0x9747b28c;
+	const size_t numBlocks = size / 16;
+	for (size_t b = 0; b < numBlocks; b++)
+	{
+		uint64_t k1, k2;
+		memcpy(&k1, data + b * 16, 8);
+		memcpy(&k2, data + b * 16 + 8, 8);
+
+		k1 *= c1; k1 = RotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = RotateLeft(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = RotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = RotateLeft(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	const unsigned char* tail = (const unsigned char*)data + numBlocks * 16;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	switch (size & 15)
+	{
+	case 15: k2 ^= (uint64_t)tail[14] << 48; // fallthrough
+	case 14: k2 ^= (uint64_t)tail[13] << 40; // fallthrough
+	case 13: k2 ^= (uint64_t)tail[12] << 32; // fallthrough
+	case 12: k2 ^= (uint64_t)tail[11] << 24; // fallthrough
+	case 11: k2 ^= (uint64_t)tail[10] << 16; // fallthrough
+	case 10: k2 ^= (uint64_t)tail[9] << 8; // fallthrough
+	case 9: k2 ^= (uint64_t)tail[8];
+		k2 *= c2; k2 = RotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+		// fallthrough
+	case 8: k1 ^= (uint64_t)tail[7] << 56; // fallthrough
+	case 7: k1 ^= (uint64_t)tail[6] << 48; // fallthrough
+	case 6: k1 ^= (uint64_t)tail[5] << 40; // fallthrough
+	case 5: k1 ^= (uint64_t)tail[4] << 32; // fallthrough
+	case 4: k1 ^= (uint64_t)tail[3] << 24; // fallthrough
+	case 3: k1 ^= (uint64_t)tail[2] << 16; // fallthrough
+	case 2: k1 ^= (uint64_t)tail[1] << 8; // fallthrough
+	case 1: k1 ^= (uint64_t)tail[0];
+		k1 *= c1; k1 = RotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= size;
+	h2 ^= size;
+	h1 += h2;
+	h2 += h1;
+	h1 = MixHash(h1);
+	h2 = MixHash(h2);
+	h1 += h2;
+	h2 += h1;
+
+	TileHash hash = { h1, h2 };
+	return hash;
+}
+
+// Collects tiles in any order (AddTile() is thread-safe) and writes the directory on Finish().
+// Tiles are deduplicated by their 128 bit content hash before they are compressed, so repeated content is only
+// compressed and stored once. Tiles aren't compared, a collision is unlikely (about 2^-64 even for 2^32 unique tiles).
+class TileArchiveWriter
+{
+	struct Blob
+	{
+		uint64_t offset;
+		uint32_t length;
+	};
+
+public:
+	TileArchiveWriter(const std::string& filePath, const TileArchiveCompression compression = TileArchiveCompressionSnappy)
+		: file(fopen(filePath.c_str(), "wb"))
+		, compression(compression)
+		, dataOffset(sizeof(TileArchiveHeader))
+		, numTiles(0)
+		, hasWriteError(false)
+	{
+		if (!file) return;
+
+		// placeholder, written again by Finish()
+		TileArchiveHeader header = CreateHeader();
+		hasWriteError = fwrite(&header, sizeof(header), 1, file) != 1;
+	}
+
+	~TileArchiveWriter()
+	{
+		Finish();
+	}
+
+	bool IsOpen() const { return file != NULL; }
+
+	void AddTile(const TileCoord& tile, const char* data, const size_t size)
+	{
+		if (size == 0 || !file) return;
+
+		const uint64_t tileId = GetTileId(tile);
+		const TileHash hash = HashTile(data, size);
+		if (AddDuplicate(tileId, hash)) return;
+
+		// compressed without holding the lock, the buffer is reused by each thread
+		thread_local std::vector<char> compressed;
+		size_t blobSize = size;
+		if (compression == TileArchiveCompressionSnappy)
+		{
+			compressed.resize(snappy::MaxCompressedLength(size));
+			snappy::RawCompress(data, size, compressed.data(), &blobSize);
+			data = compressed.data();
+		}
+
+		AppendBlob(tileId, hash, data, blobSize);
+	}
+
+	uint64_t GetNumTiles() const { return numTiles; }
+	uint64_t GetNumUniqueTiles() const { return blobs.size(); }
+
+	// sorts and writes the directory, false on write errors (including failed blob writes of AddTile())
+	bool Finish()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		if (!file) return false;
+
+		// the mapped directory is accessed in place, so it has to be aligned
+		const char padding[8] = { 0 };
+		const size_t paddingSize = (size_t)((8 - dataOffset % 8) % 8);
+		bool success = !hasWriteError && fwrite(padding, 1, paddingSize, file) == paddingSize;
+		dataOffset += paddingSize;
+
+		std::sort(entries.begin(), entries.end(), [](const TileArchiveEntry& a, const TileArchiveEntry& b) { return a.tileId < b.tileId; });
+
+		// run length encoding of consecutive tiles sharing a blob
+		size_t numRuns = 0;
+		for (const auto& entry : entries)
+		{
+			if (numRuns > 0)
+			{
+				TileArchiveEntry& run = entries[numRuns - 1];
+				if (run.tileId + run.runLength == entry.tileId && run.offset == entry.offset && run.length == entry.length)
+				{
+					run.runLength++;
+					continue;
+				}
+			}
+			entries[numRuns++] = entry;
+		}
+		entries.resize(numRuns);
+
+		success = success && (entries.empty() || fwrite(entries.data(), sizeof(TileArchiveEntry), entries.size(), file) == entries.size());
+
+		TileArchiveHeader header = CreateHeader();
+		header.numEntries = entries.size();
+		header.directoryOffset = dataOffset;
+		success = success && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+		success = fclose(file) == 0 && success;
+		file = NULL;
+		return success;
+	}
+
+private:
+	TileArchiveHeader CreateHeader() const
+	{
+		TileArchiveHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, TileArchiveMagic, sizeof(header.magic));
+		header.version = TileArchiveVersion;
+		header.compression = compression;
+		return header;
+	}
+
+	bool AddDuplicate(const uint64_t tileId, const TileHash& hash)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		auto it = blobs.find(hash);
+		if (it == blobs.end()) return false;
+
+		AddEntry(tileId, it->second);
+		return true;
+	}
+
+	void AppendBlob(const uint64_t tileId, const TileHash& hash, const char* data, const size_t size)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		if (!file) return;
+
+		auto it = blobs.find(hash); // another thread may have stored the same content meanwhile
+		if (it == blobs.end())
+		{
+			Blob blob;
+			blob.offset = dataOffset;
+			blob.length = (uint32_t)size;
+			if (fwrite(data, 1, size, file) != size) hasWriteError = true;
+			dataOffset += size;
+			it = blobs.insert(std::make_pair(hash, blob)).first;
+		}
+		AddEntry(tileId, it->second);
+	}
+
+	void AddEntry(const uint64_t tileId, const Blob& blob)
+	{
+		TileArchiveEntry entry;
+		entry.tileId = tileId;
+		entry.offset = blob.offset;
+		entry.length = blob.length;
+		entry.runLength = 1;
+		entries.push_back(entry);
+		numTiles++;
+	}
+
+	FILE* file;
+	const TileArchiveCompression compression;
+	std::mutex m;
+	std::vector<TileArchiveEntry> entries;
+	std::unordered_map<TileHash, Blob, TileHashHash> blobs; // content hash -> stored blob
+	uint64_t dataOffset;
+	uint64_t numTiles;
+	bool hasWriteError; // a failed write leaves the archive unusable, reported by Finish()
+};
+
+// Maps the directory of an archive, a tile is read with one directory probe and one positioned read.
+// Lookups and reads are thread-safe.
+class TileArchiveReader
+{
+public:
+	TileArchiveReader()
+		: directory(NULL)
+		, numEntries(0)
+		, compression(TileArchiveCompressionNone)
+		, mapping(NULL)
+		, mappingSize(0)
+#ifdef _WIN32
+		, file(INVALID_HANDLE_VALUE)
+		, fileMapping(NULL)
+#else
+		, file(-1)
+#endif
+	{
+	}
+
+	~TileArchiveReader()
+	{
+		Close();
+	}
+
+	bool Open(const std::string& filePath)
+	{
+		Close();
+
+		TileArchiveHeader header;
+		if (!OpenFile(filePath) || !Read(&header, sizeof(header), 0) ||
+			memcmp(header.magic, TileArchiveMagic, sizeof(header.magic)) != 0 || header.version != TileArchiveVersion ||
+			header.directoryOffset % 8 != 0)
+		{
+			Close();
+			return false;
+		}
+
+		compression = (TileArchiveCompression)header.compression;
+		numEntries = header.numEntries;
+		if (numEntries > 0 && !MapDirectory(header.directoryOffset, numEntries * sizeof(TileArchiveEntry)))
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (mapping) UnmapViewOfFile(mapping);
+		if (fileMapping) CloseHandle(fileMapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		fileMapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (mapping) munmap(mapping, mappingSize);
+		if (file >= 0) close(file);
+		file = -1;
+#endif
+		mapping = NULL;
+		mappingSize = 0;
+		directory = NULL;
+		numEntries = 0;
+	}
+
+	uint64_t GetNumEntries() const { return numEntries; }
+	TileArchiveCompression GetCompression() const { return compression; }
+#ifndef _WIN32
+	int GetFileDescriptor() const { return file; } // blobs of uncompressed archives can be sent as they are (sendfile)
+#endif
+
+	// false if the tile is not in the archive (empty or outside the pyramid)
+	bool FindTile(const int zoom, const int x, const int y, TileArchiveEntry& entry) const
+	{
+		// last entry starting at or before the tile
+		const uint64_t tileId = GetTileId(zoom, x, y);
+		const TileArchiveEntry* it = std::upper_bound(directory, directory + numEntries, tileId,
+			[](const uint64_t id, const TileArchiveEntry& e) { return id < e.tileId; });
+		if (it == directory) return false;
+
+		--it;
+		if (tileId - it->tileId >= it->runLength) return false;
+
+		entry = *it;
+		return true;
+	}
+
+	// uncompressed tile, false if it is missing or can't be read
+	bool ReadTile(const int zoom, const int x, const int y, std::string& tile) const
+	{
+		TileArchiveEntry entry;
+		if (!FindTile(zoom, x, y, entry)) return false;
+
+		if (compression == TileArchiveCompressionNone)
+		{
+			tile.resize(entry.length);
+			return Read(&tile[0], entry.length, entry.offset);
+		}
+
+		thread_local std::vector<char> compressed;
+		compressed.resize(entry.length);
+		size_t uncompressedLength;
+		if (!Read(compressed.data(), entry.length, entry.offset) ||
+			!snappy::GetUncompressedLength(compressed.data(), entry.length, &uncompressedLength))
+		{
+			return false;
+		}
+
+		tile.resize(uncompressedLength);
+		return snappy::RawUncompress(compressed.data(), entry.length, &tile[0]);
+	}
+
+private:
+#ifdef _WIN32
+	bool OpenFile(const std::string& filePath)
+	{
+		file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		return file != INVALID_HANDLE_VALUE;
+	}
+
+	bool Read(void* buffer, const size_t size, const uint64_t offset) const
+	{
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD numBytesRead = 0;
+		return ReadFile(file, buffer, (DWORD)size, &numBytesRead, &overlapped) && numBytesRead == size;
+	}
+
+	bool MapDirectory(const uint64_t offset, const uint64_t size)
+	{
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || (uint64_t)fileSize.QuadPart < offset + size) return false; // truncated
+
+		SYSTEM_INFO systemInfo;
+		GetSystemInfo(&systemInfo);
+		const uint64_t mappingOffset = offset - offset % systemInfo.dwAllocationGranularity;
+
+		fileMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!fileMapping) return false;
+
+		mappingSize = (size_t)(offset - mappingOffset + size);
+		mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, (DWORD)(mappingOffset >> 32), (DWORD)mappingOffset, mappingSize);
+		if (!mapping) return false;
+
+		directory = (const TileArchiveEntry*)((const char*)mapping + (offset - mappingOffset));
+		return true;
+	}
+#else
+	bool OpenFile(const std::string& filePath)
+	{
+		file = open(filePath.c_str(), O_RDONLY);
+		return file >= 0;
+	}
+
+	bool Read(void* buffer, const size_t size, const uint64_t offset) const
+	{
+		size_t numBytesRead = 0;
+		while (numBytesRead < size)
+		{
+			const ssize_t result = pread(file, (char*)buffer + numBytesRead, size - numBytesRead, (off_t)(offset + numBytesRead));
+			if (result <= 0) return false;
+			numBytesRead += (size_t)result;
+		}
+		return true;
+	}
+
+	bool MapDirectory(const uint64_t offset, const uint64_t size)
+	{
+		struct stat fileStatus;
+		if (fstat(file, &fileStatus) != 0 || (uint64_t)fileStatus.st_size < offset + size) return false; // truncated
+
+		const uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+		const uint64_t mappingOffset = offset - offset % pageSize;
+
+		mappingSize = (size_t)(offset - mappingOffset + size);
+		void* address = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, file, (off_t)mappingOffset);
+		if (address == MAP_FAILED) return false;
+
+		mapping = address;
+		directory = (const TileArchiveEntry*)((const char*)mapping + (offset - mappingOffset));
+		return true;
+	}
+#endif
+
+	const TileArchiveEntry* directory;
+	uint64_t numEntries;
+	TileArchiveCompression compression;
+	void* mapping;
+	size_t mappingSize;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE fileMapping;
+#else
+	int file;
+#endif
+};
+
+#endif // __TILEARCHIVE_H__
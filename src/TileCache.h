@@ -0,0 +1,216 @@
+#ifndef __TILECACHE_H__
+#define __TILECACHE_H__
+
+#include <stdint.h>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <chrono>
+
+#include "TileId.h"
+
+// Tiles of different index versions never match, so tiles of a replaced index are just evicted over time
+struct TileCacheKey
+{
+	uint64_t tileId;
+	uint64_t indexVersion;
+
+	bool operator==(const TileCacheKey& other) const
+	{
+		return tileId == other.tileId && indexVersion == other.indexVersion;
+	}
+};
+
+struct TileCacheKeyHash
+{
+	size_t operator()(const TileCacheKey& key) const
+	{
+		return (size_t)((key.tileId * 0x9e3779b97f4a7c15ull) ^ key.indexVersion);
+	}
+};
+
+// Thread-safe cache of built tiles for on-demand generation, bounded by a memory budget in bytes.
+// Missing tiles are built by the caller provided function. Concurrent requests for a tile which is being built
+// wait for that build instead of building it again (single flight).
+// Eviction is cost aware (GreedyDual-Size): an entry's priority is its build time per byte plus the priority of the
+// last evicted entry, the lowest priority is evicted first. Tiles which are expensive to build but small stay longer,
+// entries which aren't requested anymore age out as the priorities of new entries rise.
+// Like CachedDiskStorageManager the cache is split into NumShards shards, each one guarded by its own mutex.
+class TileCache
+{
+	static const uint64_t DefaultCacheSizeInBytes = 256 << 20;
+	static const uint64_t EntryOverheadInBytes = 128;
+	static const int NumShards = 16;
+
+public:
+	typedef std::shared_ptr<const std::string> Tile;
+
+	TileCache(const uint64_t cacheSizeInBytes = DefaultCacheSizeInBytes)
+		: numHits(0)
+		, numMisses(0)
+		, numCoalescedMisses(0)
+		, numEvictions(0)
+	{
+		for (int s = 0; s < NumShards; s++)
+		{
+			shards[s].cacheSizeInBytes = cacheSizeInBytes / NumShards;
+		}
+	}
+
+	// buildTile(std::string& tile) is called on a miss, exceptions are passed on to all waiting requests
+	template <class BuildTile>
+	Tile Get(const TileCoord& coord, const uint64_t indexVersion, BuildTile buildTile)
+	{
+		const TileCacheKey key = { GetTileId(coord), indexVersion };
+		Shard& shard = GetShard(key);
+
+		std::promise<Tile> promise;
+		{
+			std::unique_lock<std::mutex> lock(shard.m);
+			auto entry = shard.entries.find(key);
+			if (entry != shard.entries.end())
+			{
+				numHits++;
+				UpdatePriority(shard, key, entry->second);
+				return entry->second.tile;
+			}
+
+			auto build = shard.builds.find(key);
+			if (build != shard.builds.end())
+			{
+				std::shared_future<Tile> tile = build->second;
+				lock.unlock();
+
+				numCoalescedMisses++;
+				return tile.get();
+			}
+
+			shard.builds.insert(std::make_pair(key, promise.get_future().share()));
+		}
+		numMisses++;
+
+		// built without holding the lock, other tiles of the shard can be served meanwhile
+		std::shared_ptr<std::string> tile = std::make_shared<std::string>();
+		const std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+		try
+		{
+			buildTile(*tile);
+		}
+		catch (...)
+		{
+			{
+				std::lock_guard<std::mutex> lock(shard.m);
+				shard.builds.erase(key);
+			}
+			promise.set_exception(std::current_exception());
+			throw;
+		}
+		const double cost = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - t1).count();
+
+		{
+			std::lock_guard<std::mutex> lock(shard.m);
+			shard.builds.erase(key);
+			AddEntry(shard, key, tile, cost);
+		}
+		promise.set_value(tile);
+		return tile;
+	}
+
+	void Clear()
+	{
+		for (int s = 0; s < NumShards; s++)
+		{
+			std::lock_guard<std::mutex> lock(shards[s].m);
+			shards[s].entries.clear();
+			shards[s].priorities.clear();
+			shards[s].numBytesCached = 0;
+		}
+	}
+
+	uint64_t GetNumHits() const { return numHits; }
+	uint64_t GetNumMisses() const { return numMisses; }
+	uint64_t GetNumCoalescedMisses() const { return numCoalescedMisses; } // requests which waited for a running build
+	uint64_t GetNumEvictions() const { return numEvictions; }
+
+private:
+	typedef std::multimap<double, TileCacheKey> PriorityMap;
+
+	struct Entry
+	{
+		Tile tile;
+		double cost; // build time in seconds
+		PriorityMap::iterator priority;
+	};
+
+	struct Shard
+	{
+		std::mutex m;
+		std::unordered_map<TileCacheKey, Entry, TileCacheKeyHash> entries;
+		std::unordered_map<TileCacheKey, std::shared_future<Tile>, TileCacheKeyHash> builds; // in flight
+		PriorityMap priorities; // lowest is evicted first
+		double inflation; // priority of the last evicted entry
+		uint64_t cacheSizeInBytes;
+		uint64_t numBytesCached;
+
+		Shard()
+			: inflation(0.0)
+			, cacheSizeInBytes(0)
+			, numBytesCached(0)
+		{
+		}
+	};
+
+	Shard& GetShard(const TileCacheKey& key)
+	{
+		return shards[TileCacheKeyHash()(key) % NumShards];
+	}
+
+	static uint64_t GetSizeInBytes(const Tile& tile)
+	{
+		return tile->size() + EntryOverheadInBytes;
+	}
+
+	static double ComputePriority(const Shard& shard, const Entry& entry)
+	{
+		return shard.inflation + entry.cost / GetSizeInBytes(entry.tile);
+	}
+
+	void UpdatePriority(Shard& shard, const TileCacheKey& key, Entry& entry)
+	{
+		shard.priorities.erase(entry.priority);
+		entry.priority = shard.priorities.insert(std::make_pair(ComputePriority(shard, entry), key));
+	}
+
+	void AddEntry(Shard& shard, const TileCacheKey& key, const Tile& tile, const double cost)
+	{
+		Entry& entry = shard.entries[key];
+		entry.tile = tile;
+		entry.cost = cost;
+		entry.priority = shard.priorities.insert(std::make_pair(ComputePriority(shard, entry), key));
+		shard.numBytesCached += GetSizeInBytes(tile);
+
+		while (shard.numBytesCached > shard.cacheSizeInBytes && !shard.priorities.empty())
+		{
+			const PriorityMap::iterator lowest = shard.priorities.begin();
+			shard.inflation = lowest->first;
+
+			auto evicted = shard.entries.find(lowest->second);
+			shard.numBytesCached -= GetSizeInBytes(evicted->second.tile);
+			shard.entries.erase(evicted);
+			shard.priorities.erase(lowest);
+			numEvictions++;
+		}
+	}
+
+	Shard shards[NumShards];
+	std::atomic<uint64_t> numHits;
+	std::atomic<uint64_t> numMisses;
+	std::atomic<uint64_t> numCoalescedMisses;
+	std::atomic<uint64_t> numEvictions;
+};
+
+#endif // __TILECACHE_H__
@@ -0,0 +1,236 @@
+#ifndef __TILECLIPPER_H__
+#define __TILECLIPPER_H__
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include <ZFXMath.h>
+
+#include "o5mindexer.h"
+
+// Clips tile space geometry (integer coordinates) to a box, usually the tile extent grown by a buffer
+// so lines and outlines don't end visibly at tile borders.
+// Polygon rings are clipped with Sutherland-Hodgman. It keeps the vertex order, so ring orientation is preserved.
+// Concave rings may get zero width connections along the box border, which don't affect rendering.
+// Lines are clipped segment by segment (Cohen-Sutherland) and split into one part per visible section.
+// Holds scratch buffers, so each thread needs its own clipper.
+class TileClipper
+{
+	typedef ZFXMath::TPolygon2D<int32_t> Ring;
+	typedef ZFXMath::TVector2D<int32_t> Vertex;
+
+	enum Edge
+	{
+		EdgeLeft = 1,
+		EdgeRight = 2,
+		EdgeTop = 4,
+		EdgeBottom = 8,
+	};
+
+public:
+	// box of the tile extent grown by the buffer on all sides
+	static BBox GetClipBox(const uint32_t extent, const int32_t buffer)
+	{
+		BBox box;
+		box.minX = box.minY = -buffer;
+		box.maxX = box.maxY = (int32_t)extent + buffer;
+		return box;
+	}
+
+	// false if nothing of the ring (without closing vertex) is left
+	bool ClipRing(const Ring& source, const BBox& box, Ring& target)
+	{
+		const int numVertices = source.GetNumVertices();
+		const Vertex* vertices = source.GetVertices();
+
+		const BBox bbox = ComputeBBox(vertices, numVertices);
+		if (bbox.maxX < box.minX || bbox.minX > box.maxX || bbox.maxY < box.minY || bbox.minY > box.maxY) return false;
+
+		if (bbox.minX >= box.minX && bbox.maxX <= box.maxX && bbox.minY >= box.minY && bbox.maxY <= box.maxY)
+		{
+			target.SetNumVertices(numVertices);
+			std::copy(vertices, vertices + numVertices, target.GetVertices());
+			return numVertices >= 3;
+		}
+
+		clipped.assign(vertices, vertices + numVertices);
+		const Edge edges[] = { EdgeLeft, EdgeRight, EdgeTop, EdgeBottom };
+		for (const Edge edge : edges)
+		{
+			ClipAgainstEdge(clipped, box, edge, scratch);
+			clipped.swap(scratch);
+		}
+
+		// intersections rounded to the same vertex
+		size_t numClipped = 0;
+		for (size_t v = 0; v < clipped.size(); v++)
+		{
+			if (numClipped > 0 && IsEqual(clipped[v], clipped[numClipped - 1])) continue;
+			clipped[numClipped++] = clipped[v];
+		}
+		while (numClipped > 1 && IsEqual(clipped[0], clipped[numClipped - 1])) numClipped--;
+		if (numClipped < 3) return false;
+
+		target.SetNumVertices((int)numClipped);
+		std::copy(clipped.begin(), clipped.begin() + numClipped, target.GetVertices());
+		return target.ComputeArea<int64_t>() != 0;
+	}
+
+	// appends the visible sections of the line to parts, returns their number
+	size_t ClipLine(const Ring& source, const BBox& box, std::vector<Ring>& parts)
+	{
+		const int numVertices = source.GetNumVertices();
+		const Vertex* vertices = source.GetVertices();
+		const size_t numParts = parts.size();
+
+		const BBox bbox = ComputeBBox(vertices, numVertices);
+		if (bbox.maxX < box.minX || bbox.minX > box.maxX || bbox.maxY < box.minY || bbox.minY > box.maxY) return 0;
+
+		if (bbox.minX >= box.minX && bbox.maxX <= box.maxX && bbox.minY >= box.minY && bbox.maxY <= box.maxY)
+		{
+			if (numVertices < 2) return 0;
+			parts.push_back(Ring());
+			parts.back().SetNumVertices(numVertices);
+			std::copy(vertices, vertices + numVertices, parts.back().GetVertices());
+			return 1;
+		}
+
+		clipped.clear();
+		for (int v = 1; v < numVertices; v++)
+		{
+			Vertex a = vertices[v - 1];
+			Vertex b = vertices[v];
+			if (!ClipSegment(box, a, b)) continue;
+
+			if (!clipped.empty() && !IsEqual(clipped.back(), a))
+			{
+				AddLinePart(parts);
+			}
+			if (clipped.empty()) clipped.push_back(a);
+			if (!IsEqual(clipped.back(), b)) clipped.push_back(b);
+
+			if (!IsEqual(b, vertices[v])) AddLinePart(parts); // the line leaves the box
+		}
+		AddLinePart(parts);
+
+		return parts.size() - numParts;
+	}
+
+private:
+	static bool IsEqual(const Vertex& a, const Vertex& b)
+	{
+		return a.x == b.x && a.y == b.y;
+	}
+
+	static BBox ComputeBBox(const Vertex* vertices, const int numVertices)
+	{
+		BBox bbox;
+		bbox.minX = bbox.minY = std::numeric_limits<int32_t>::max();
+		bbox.maxX = bbox.maxY = std::numeric_limits<int32_t>::min();
+		for (int v = 0; v < numVertices; v++)
+		{
+			bbox.minX = std::min(bbox.minX, vertices[v].x);
+			bbox.minY = std::min(bbox.minY, vertices[v].y);
+			bbox.maxX = std::max(bbox.maxX, vertices[v].x);
+			bbox.maxY = std::max(bbox.maxY, vertices[v].y);
+		}
+		return bbox;
+	}
+
+	static int GetOutCode(const Vertex& vertex, const BBox& box)
+	{
+		int code = 0;
+		if (vertex.x < box.minX) code |= EdgeLeft;
+		if (vertex.x > box.maxX) code |= EdgeRight;
+		if (vertex.y < box.minY) code |= EdgeTop;
+		if (vertex.y > box.maxY) code |= EdgeBottom;
+		return code;
+	}
+
+	static bool IsInside(const Vertex& vertex, const BBox& box, const Edge edge)
+	{
+		return (GetOutCode(vertex, box) & edge) == 0;
+	}
+
+	// intersection of the segment with the edge line, a and b are on different sides of it
+	static Vertex Intersect(const Vertex& a, const Vertex& b, const BBox& box, const Edge edge)
+	{
+		const bool isVertical = edge == EdgeLeft || edge == EdgeRight;
+		const int32_t border = edge == EdgeLeft ? box.minX : edge == EdgeRight ? box.maxX : edge == EdgeTop ? box.minY : box.maxY;
+
+		const double t = isVertical
+			? ((double)border - a.x) / ((double)b.x - a.x)
+			: ((double)border - a.y) / ((double)b.y - a.y);
+
+		return isVertical
+			? Vertex(border, (int32_t)floor(a.y + t * ((double)b.y - a.y) + 0.5))
+			: Vertex((int32_t)floor(a.x + t * ((double)b.x - a.x) + 0.5), border);
+	}
+
+	static void ClipAgainstEdge(const std::vector<Vertex>& input, const BBox& box, const Edge edge, std::vector<Vertex>& output)
+	{
+		output.clear();
+		if (input.empty()) return;
+
+		const Vertex* previous = &input.back();
+		bool isPreviousInside = IsInside(*previous, box, edge);
+		for (const Vertex& vertex : input)
+		{
+			const bool isInside = IsInside(vertex, box, edge);
+			if (isInside != isPreviousInside)
+			{
+				output.push_back(Intersect(*previous, vertex, box, edge));
+			}
+			if (isInside)
+			{
+				output.push_back(vertex);
+			}
+			previous = &vertex;
+			isPreviousInside = isInside;
+		}
+	}
+
+	// Cohen-Sutherland, false if the segment is completely outside
+	static bool ClipSegment(const BBox& box, Vertex& a, Vertex& b)
+	{
+		int codeA = GetOutCode(a, box);
+		int codeB = GetOutCode(b, box);
+		while (codeA | codeB)
+		{
+			if (codeA & codeB) return false;
+
+			const int code = codeA ? codeA : codeB;
+			const Edge edge = (code & EdgeLeft) ? EdgeLeft : (code & EdgeRight) ? EdgeRight : (code & EdgeTop) ? EdgeTop : EdgeBottom;
+			if (code == codeA)
+			{
+				a = Intersect(a, b, box, edge);
+				codeA = GetOutCode(a, box);
+			}
+			else
+			{
+				b = Intersect(a, b, box, edge);
+				codeB = GetOutCode(b, box);
+			}
+		}
+		return true;
+	}
+
+	void AddLinePart(std::vector<Ring>& parts)
+	{
+		if (clipped.size() >= 2)
+		{
+			parts.push_back(Ring());
+			parts.back().SetNumVertices((int)clipped.size());
+			std::copy(clipped.begin(), clipped.end(), parts.back().GetVertices());
+		}
+		clipped.clear();
+	}
+
+	std::vector<Vertex> clipped;
+	std::vector<Vertex> scratch;
+};
+
+#endif // __TILECLIPPER_H__
@@ -0,0 +1,106 @@
+#ifndef __TILEID_H__
+#define __TILEID_H__
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+
+struct TileCoord
+{
+	int zoom;
+	int x;
+	int y;
+};
+
+// position of the tile on the Hilbert curve through all 2^zoom x 2^zoom tiles of its zoom level,
+// neighbouring positions are neighbouring tiles
+inline uint64_t GetHilbertIndex(const int zoom, uint32_t x, uint32_t y)
+{
+	const uint32_t n = 1u << zoom;
+	uint64_t index = 0;
+	for (uint32_t s = n / 2; s > 0; s /= 2)
+	{
+		const uint32_t rx = (x & s) > 0;
+		const uint32_t ry = (y & s) > 0;
+		index += (uint64_t)s * s * ((3 * rx) ^ ry);
+
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			std::swap(x, y);
+		}
+	}
+	return index;
+}
+
+// Unique id of a tile: the number of tiles of all lower zoom levels plus the Hilbert index within its zoom level.
+// Sorting by id orders tiles by zoom level, then along the Hilbert curve.
+inline uint64_t GetTileId(const int zoom, const int x, const int y)
+{
+	const uint64_t numLowerZoomTiles = ((1ull << (2 * zoom)) - 1) / 3;
+	return numLowerZoomTiles + GetHilbertIndex(zoom, (uint32_t)x, (uint32_t)y);
+}
+
+inline uint64_t GetTileId(const TileCoord& tile)
+{
+	return GetTileId(tile.zoom, tile.x, tile.y);
+}
+
+// tiles of one zoom level covering a lon/lat bbox (inclusive)
+struct TileRange
+{
+	int zoom;
+	int minX;
+	int minY;
+	int maxX;
+	int maxY;
+
+	// low and high in degrees (lon, lat) like TileProjection::GetBounds()
+	static TileRange Create(const int zoom, const double* low, const double* high)
+	{
+		TileRange range;
+		range.zoom = zoom;
+		range.minX = LonToTileX(low[0], zoom);
+		range.maxX = LonToTileX(high[0], zoom);
+		range.minY = LatToTileY(high[1], zoom);
+		range.maxY = LatToTileY(low[1], zoom);
+		return range;
+	}
+
+	bool Contains(const int x, const int y) const
+	{
+		return x >= minX && x <= maxX && y >= minY && y <= maxY;
+	}
+
+	uint64_t GetNumTiles() const
+	{
+		return (uint64_t)(maxX - minX + 1) * (uint64_t)(maxY - minY + 1);
+	}
+
+private:
+	static int ClampToTile(const double value, const int zoom)
+	{
+		const int numTiles = 1 << zoom;
+		return std::max(0, std::min(numTiles - 1, (int)floor(value * numTiles)));
+	}
+
+	static int LonToTileX(const double lon, const int zoom)
+	{
+		return ClampToTile((lon + 180.0) / 360.0, zoom);
+	}
+
+	static int LatToTileY(const double lat, const int zoom)
+	{
+		const double Pi = 3.14159265358979323846;
+		const double MaxLatitude = 85.0511287798;
+
+		const double latitude = std::max(-MaxLatitude, std::min(MaxLatitude, lat)) * Pi / 180.0;
+		return ClampToTile((1.0 - log(tan(latitude) + 1.0 / cos(latitude)) / Pi) / 2.0, zoom);
+	}
+};
+
+#endif // __TILEID_H__
@@ -0,0 +1,260 @@
+#ifndef __TILEPYRAMIDBUILDER_H__
+#define __TILEPYRAMIDBUILDER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "TileId.h"
+#include "VectorTileBuilder.h"
+#include "MVTWriter.h"
+
+// Receives the tiles of the pyramid, called concurrently by all worker threads.
+// The tile data is only valid during the call.
+class ITileSink
+{
+public:
+	virtual ~ITileSink() {}
+	virtual void AddTile(const TileCoord& tile, const char* data, const size_t size) = 0;
+};
+
+// Builds all tiles of a zoom range over a bbox with a pool of worker threads, each one with its own
+// VectorTileBuilder and MVTWriter (buffers are reused from tile to tile).
+// The tiles of the lowest zoom level are split in Hilbert order into one contiguous run per worker.
+// Once a tile is built its children are pushed onto the worker's own queue, so workers descend depth first
+// into the area of their last tile and the index pages and ways of that area stay hot in the caches.
+// Idle workers steal the oldest tiles (large unprocessed subtrees) from the other queues.
+class TilePyramidBuilder
+{
+	struct WorkQueue
+	{
+		std::mutex m;
+		std::deque<TileCoord> tiles; // own worker pops from the back, thieves from the front
+	};
+
+	struct ZoomStatistics
+	{
+		uint64_t numTiles;
+		uint64_t numBytes;
+		double seconds; // summed over all worker threads
+	};
+
+public:
+	TilePyramidBuilder(IPinnedPageStorageManager& storage, const ZoomBandSet& zoomBands, const WayStore& wayStore,
+		const TagDictionary& tagDictionary, const std::vector<TileLayerDefinition>& layerDefinitions, const int numThreads)
+		: storage(storage)
+		, zoomBands(zoomBands)
+		, wayStore(wayStore)
+		, tagDictionary(tagDictionary)
+		, layerDefinitions(layerDefinitions)
+		, numThreads(std::max(1, numThreads))
+	{
+	}
+
+	// low and high in degrees (lon, lat), false if the zoom range is not within [0, MaxZoom]
+	bool Build(const double* low, const double* high, const int minZoom, const int maxZoom, ITileSink& sink)
+	{
+		if (minZoom < 0 || maxZoom > MaxZoom || minZoom > maxZoom) return false;
+
+		ranges.clear();
+		for (int zoom = 0; zoom <= maxZoom; zoom++)
+		{
+			ranges.push_back(TileRange::Create(zoom, low, high));
+		}
+		this->minZoom = minZoom;
+		this->maxZoom = maxZoom;
+		statistics.assign(maxZoom + 1, ZoomStatistics());
+
+		std::vector<TileCoord> seeds;
+		const TileRange& range = ranges[minZoom];
+		for (int y = range.minY; y <= range.maxY; y++)
+		{
+			for (int x = range.minX; x <= range.maxX; x++)
+			{
+				seeds.push_back(TileCoord{ minZoom, x, y });
+			}
+		}
+		std::sort(seeds.begin(), seeds.end(), [](const TileCoord& a, const TileCoord& b) { return GetTileId(a) < GetTileId(b); });
+
+		// runs are pushed in reverse, so each worker starts at the beginning of its run
+		queues = std::vector<WorkQueue>(numThreads);
+		for (int t = 0; t < numThreads; t++)
+		{
+			const size_t begin = seeds.size() * t / numThreads;
+			const size_t end = seeds.size() * (t + 1) / numThreads;
+			queues[t].tiles.assign(seeds.rbegin() + (seeds.size() - end), seeds.rbegin() + (seeds.size() - begin));
+		}
+		numPendingTiles = seeds.size();
+		workVersion = 0;
+
+		const std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+
+		std::vector<std::thread> workers;
+		for (int t = 0; t < numThreads; t++)
+		{
+			workers.push_back(std::thread([this, t, &sink]() { Work(t, sink); }));
+		}
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+
+		seconds = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - t1).count();
+		return true;
+	}
+
+	void PrintStatistics() const
+	{
+		uint64_t numTiles = 0;
+		for (int zoom = minZoom; zoom <= maxZoom; zoom++)
+		{
+			const ZoomStatistics& zoomStatistics = statistics[zoom];
+			numTiles += zoomStatistics.numTiles;
+			printf("Zoom %2d: %10llu tiles, %12llu bytes, %10.1f tiles/s per thread\n", zoom,
+				(unsigned long long)zoomStatistics.numTiles, (unsigned long long)zoomStatistics.numBytes,
+				zoomStatistics.seconds > 0.0 ? zoomStatistics.numTiles / zoomStatistics.seconds : 0.0);
+		}
+		printf("%llu tiles in %.1f seconds (%.1f tiles/s, %d threads)\n", (unsigned long long)numTiles, seconds,
+			seconds > 0.0 ? numTiles / seconds : 0.0, numThreads);
+	}
+
+private:
+	void Work(const int thread, ITileSink& sink)
+	{
+		VectorTileBuilder builder(storage, zoomBands, wayStore, tagDictionary, layerDefinitions);
+		MVTWriter writer;
+		std::vector<ZoomStatistics> threadStatistics(maxZoom + 1, ZoomStatistics());
+
+		TileCoord tile;
+		while (numPendingTiles > 0)
+		{
+			uint64_t seenWorkVersion;
+			{
+				std::lock_guard<std::mutex> lock(idleMutex);
+				seenWorkVersion = workVersion;
+			}
+
+			if (!Pop(thread, tile) && !Steal(thread, tile))
+			{
+				// remaining tiles are being built, wait until they add children or the last one is done
+				std::unique_lock<std::mutex> lock(idleMutex);
+				workAdded.wait(lock, [&]() { return workVersion != seenWorkVersion || numPendingTiles == 0; });
+				continue;
+			}
+
+			const std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+			builder.BuildTile(tile.zoom, tile.x, tile.y, writer);
+			sink.AddTile(tile, writer.GetData(), writer.GetSize());
+
+			ZoomStatistics& zoomStatistics = threadStatistics[tile.zoom];
+			zoomStatistics.numTiles++;
+			zoomStatistics.numBytes += writer.GetSize();
+			zoomStatistics.seconds += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - t1).count();
+
+			if (tile.zoom < maxZoom)
+			{
+				PushChildren(thread, tile);
+			}
+			if (--numPendingTiles == 0) // after the children were added, so no worker quits early
+			{
+				NotifyWorkAdded();
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(statisticsMutex);
+		for (int zoom = 0; zoom <= maxZoom; zoom++)
+		{
+			statistics[zoom].numTiles += threadStatistics[zoom].numTiles;
+			statistics[zoom].numBytes += threadStatistics[zoom].numBytes;
+			statistics[zoom].seconds += threadStatistics[zoom].seconds;
+		}
+	}
+
+	// children within the bbox, pushed in reverse Hilbert order so the first one is built next
+	void PushChildren(const int thread, const TileCoord& tile)
+	{
+		TileCoord children[4];
+		int numChildren = 0;
+		const TileRange& range = ranges[tile.zoom + 1];
+		for (int c = 0; c < 4; c++)
+		{
+			const TileCoord child = { tile.zoom + 1, tile.x * 2 + (c & 1), tile.y * 2 + (c >> 1) };
+			if (range.Contains(child.x, child.y)) children[numChildren++] = child;
+		}
+		std::sort(children, children + numChildren, [](const TileCoord& a, const TileCoord& b) { return GetTileId(a) > GetTileId(b); });
+
+		if (numChildren == 0) return;
+
+		numPendingTiles += numChildren;
+		{
+			WorkQueue& queue = queues[thread];
+			std::lock_guard<std::mutex> lock(queue.m);
+			queue.tiles.insert(queue.tiles.end(), children, children + numChildren);
+		}
+		NotifyWorkAdded();
+	}
+
+	void NotifyWorkAdded()
+	{
+		std::lock_guard<std::mutex> lock(idleMutex);
+		workVersion++;
+		workAdded.notify_all();
+	}
+
+	bool Pop(const int thread, TileCoord& tile)
+	{
+		WorkQueue& queue = queues[thread];
+		std::lock_guard<std::mutex> lock(queue.m);
+		if (queue.tiles.empty()) return false;
+
+		tile = queue.tiles.back();
+		queue.tiles.pop_back();
+		return true;
+	}
+
+	bool Steal(const int thread, TileCoord& tile)
+	{
+		for (int v = 1; v < numThreads; v++)
+		{
+			WorkQueue& queue = queues[(thread + v) % numThreads];
+			std::lock_guard<std::mutex> lock(queue.m);
+			if (queue.tiles.empty()) continue;
+
+			tile = queue.tiles.front();
+			queue.tiles.pop_front();
+			return true;
+		}
+		return false;
+	}
+
+	IPinnedPageStorageManager& storage;
+	const ZoomBandSet& zoomBands;
+	const WayStore& wayStore;
+	const TagDictionary& tagDictionary;
+	const std::vector<TileLayerDefinition>& layerDefinitions;
+	const int numThreads;
+
+	int minZoom;
+	int maxZoom;
+	std::vector<TileRange> ranges;
+	std::vector<WorkQueue> queues;
+	std::atomic<uint64_t> numPendingTiles;
+
+	// idle workers wait for new children, workVersion changes whenever tiles were added or the last one is done
+	std::mutex idleMutex;
+	std::condition_variable workAdded;
+	uint64_t workVersion;
+
+	std::mutex statisticsMutex;
+	std::vector<ZoomStatistics> statistics;
+	double seconds;
+};
+
+#endif // __TILEPYRAMIDBUILDER_H__
@@ -0,0 +1,749 @@
+#ifndef __TILESERVER_H__
+#define __TILESERVER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+
+// sockets before TileArchive.h (windows.h)
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET TileServerSocket;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+typedef int TileServerSocket;
+#endif
+
+#include "TileId.h"
+#include "TileArchive.h"
+#include "TileCache.h"
+#include "VectorTileBuilder.h"
+#include "MVTWriter.h"
+
+// Response latencies in power of 2 buckets of microseconds (bucket b: [2^(b-1), 2^b)), recording is lock-free
+class LatencyHistogram
+{
+	static const int NumBuckets = 32;
+
+public:
+	LatencyHistogram()
+		: numSamples(0)
+		, sumMicroseconds(0)
+		, maxMicroseconds(0)
+	{
+		for (int b = 0; b < NumBuckets; b++)
+		{
+			buckets[b] = 0;
+		}
+	}
+
+	void Record(const double seconds)
+	{
+		const uint64_t microseconds = (uint64_t)(seconds * 1e6);
+		int bucket = 0;
+		while (bucket < NumBuckets - 1 && (1ull << bucket) <= microseconds) bucket++;
+
+		buckets[bucket]++;
+		numSamples++;
+		sumMicroseconds += microseconds;
+
+		uint64_t max = maxMicroseconds;
+		while (microseconds > max && !maxMicroseconds.compare_exchange_weak(max, microseconds));
+	}
+
+	// upper bound of the bucket the percentile (0..1) falls into
+	uint64_t GetPercentile(const double percentile) const
+	{
+		const uint64_t n = numSamples;
+		if (n == 0) return 0;
+
+		const uint64_t rank = std::max<uint64_t>(1, (uint64_t)(percentile * n + 0.5));
+		uint64_t count = 0;
+		for (int b = 0; b < NumBuckets; b++)
+		{
+			count += buckets[b];
+			if (count >= rank) return std::min<uint64_t>(1ull << b, maxMicroseconds);
+		}
+		return maxMicroseconds;
+	}
+
+	uint64_t GetNumSamples() const { return numSamples; }
+	uint64_t GetMeanMicroseconds() const { return numSamples > 0 ? sumMicroseconds / numSamples : 0; }
+	uint64_t GetMaxMicroseconds() const { return maxMicroseconds; }
+
+private:
+	std::atomic<uint64_t> buckets[NumBuckets];
+	std::atomic<uint64_t> numSamples;
+	std::atomic<uint64_t> sumMicroseconds;
+	std::atomic<uint64_t> maxMicroseconds;
+};
+
+// Minimal HTTP/1.1 server for localhost:
+//   GET /z/x/y.mvt  tile from the archive, tiles missing there are built on demand (if enabled)
+//   GET /stats      latency histograms per endpoint and cache statistics
+// A fixed pool of worker threads serves the requests received on a connection, then the connection is handed back
+// and waits in poll() until further requests arrive, so idle keep-alive connections don't occupy a worker.
+// Connections are kept alive until the client closes them, KeepAliveTimeout passes without a request
+// or MaxRequestsPerConnection are served.
+// Tiles of uncompressed archives are sent straight from the file (sendfile), compressed ones are decompressed.
+// Each worker has its own VectorTileBuilder, built tiles are shared by all workers through a TileCache.
+class TileServer
+{
+	static const int KeepAliveTimeout = 5; // seconds
+	static const int MaxRequestsPerConnection = 1000;
+	static const size_t MaxRequestSize = 8192;
+	static const int AcceptRetryDelay = 100; // milliseconds, accept() fails until descriptors are available again (EMFILE)
+
+	enum Endpoint
+	{
+		EndpointArchive,
+		EndpointOnDemand,
+		EndpointStats,
+		EndpointError,
+		NumEndpoints,
+	};
+
+	struct Request
+	{
+		std::string method;
+		std::string target;
+		bool keepAlive;
+		bool hasBody;
+	};
+
+	struct Connection
+	{
+		TileServerSocket socket;
+		std::string received; // pipelined or partial requests
+		int numRequests;
+		std::chrono::steady_clock::time_point idleSince;
+	};
+
+	struct OnDemandGeneration
+	{
+		IPinnedPageStorageManager* storage;
+		const ZoomBandSet* zoomBands;
+		const WayStore* wayStore;
+		const TagDictionary* tagDictionary;
+		const std::vector<TileLayerDefinition>* layerDefinitions;
+		uint64_t indexVersion;
+	};
+
+	// per thread state
+	struct Worker
+	{
+		std::unique_ptr<VectorTileBuilder> builder;
+		MVTWriter writer;
+		std::string tile;
+		std::string header;
+	};
+
+public:
+	TileServer(const int numThreads)
+		: numThreads(std::max(1, numThreads))
+		, archive(NULL)
+		, listener(InvalidSocket())
+		, wakeUp(InvalidSocket())
+		, running(false)
+	{
+		memset(&generation, 0, sizeof(generation));
+	}
+
+	~TileServer()
+	{
+		Stop();
+	}
+
+	// the archive has to stay open while the server runs
+	void SetArchive(const TileArchiveReader* archive)
+	{
+		this->archive = archive;
+	}
+
+	// indexVersion has to change whenever the index is rebuilt, it is part of the cache key
+	void SetOnDemandGeneration(IPinnedPageStorageManager& storage, const ZoomBandSet& zoomBands, const WayStore& wayStore,
+		const TagDictionary& tagDictionary, const std::vector<TileLayerDefinition>& layerDefinitions, const uint64_t indexVersion,
+		const uint64_t cacheSizeInBytes = 256 << 20)
+	{
+		generation.storage = &storage;
+		generation.zoomBands = &zoomBands;
+		generation.wayStore = &wayStore;
+		generation.tagDictionary = &tagDictionary;
+		generation.layerDefinitions = &layerDefinitions;
+		generation.indexVersion = indexVersion;
+		cache.reset(new TileCache(cacheSizeInBytes));
+	}
+
+	// listens on 127.0.0.1 and serves until Stop() is called, false if the port can't be opened
+	bool Run(const int port)
+	{
+#ifdef _WIN32
+		WSADATA wsaData;
+		if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) return false;
+#else
+		signal(SIGPIPE, SIG_IGN); // closed connections are reported by send()
+#endif
+
+		listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (listener == InvalidSocket()) return false;
+
+		const int reuseAddress = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuseAddress, sizeof(reuseAddress));
+
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons((uint16_t)port);
+		if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+		{
+			CloseSocket(listener);
+			listener = InvalidSocket();
+			return false;
+		}
+
+		if (!OpenWakeUpSocket())
+		{
+			CloseSocket(listener);
+			listener = InvalidSocket();
+			return false;
+		}
+
+		running = true;
+		std::vector<std::thread> workers;
+		for (int t = 0; t < numThreads; t++)
+		{
+			workers.push_back(std::thread([this]() { Work(); }));
+		}
+
+		Dispatch();
+
+		connectionAdded.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+
+		std::lock_guard<std::mutex> lock(m);
+		for (auto& connection : connections)
+		{
+			CloseSocket(connection->socket);
+		}
+		for (auto& connection : returnedConnections)
+		{
+			CloseSocket(connection->socket);
+		}
+		connections.clear();
+		returnedConnections.clear();
+		CloseSocket(listener);
+		CloseSocket(wakeUp);
+		listener = InvalidSocket();
+		wakeUp = InvalidSocket();
+
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return true;
+	}
+
+	// may be called from any thread, connections being served are closed after their current request
+	void Stop()
+	{
+		if (!running.exchange(false)) return;
+
+		// wakes up poll(), the sockets are closed by Run()
+		std::lock_guard<std::mutex> lock(m);
+		WakeUp();
+		connectionAdded.notify_all();
+	}
+
+	std::string GetStatistics() const
+	{
+		static const char* const EndpointNames[NumEndpoints] = { "archive", "on-demand", "stats", "error" };
+
+		std::string text;
+		char line[256];
+		for (int e = 0; e < NumEndpoints; e++)
+		{
+			const LatencyHistogram& histogram = histograms[e];
+			snprintf(line, sizeof(line), "%-10s %10llu requests, mean %8llu us, p50 %8llu us, p90 %8llu us, p99 %8llu us, max %8llu us\n",
+				EndpointNames[e], (unsigned long long)histogram.GetNumSamples(), (unsigned long long)histogram.GetMeanMicroseconds(),
+				(unsigned long long)histogram.GetPercentile(0.5), (unsigned long long)histogram.GetPercentile(0.9),
+				(unsigned long long)histogram.GetPercentile(0.99), (unsigned long long)histogram.GetMaxMicroseconds());
+			text += line;
+		}
+
+		if (cache)
+		{
+			snprintf(line, sizeof(line), "cache      %10llu hits, %llu misses, %llu coalesced misses, %llu evictions\n",
+				(unsigned long long)cache->GetNumHits(), (unsigned long long)cache->GetNumMisses(),
+				(unsigned long long)cache->GetNumCoalescedMisses(), (unsigned long long)cache->GetNumEvictions());
+			text += line;
+		}
+		return text;
+	}
+
+private:
+	static TileServerSocket InvalidSocket()
+	{
+#ifdef _WIN32
+		return INVALID_SOCKET;
+#else
+		return -1;
+#endif
+	}
+
+	static void CloseSocket(const TileServerSocket s)
+	{
+		if (s == InvalidSocket()) return;
+#ifdef _WIN32
+		closesocket(s);
+#else
+		close(s);
+#endif
+	}
+
+#ifdef _WIN32
+	static int Poll(std::vector<WSAPOLLFD>& descriptors, const int timeout)
+	{
+		return WSAPoll(descriptors.data(), (ULONG)descriptors.size(), timeout);
+	}
+#else
+	static int Poll(std::vector<pollfd>& descriptors, const int timeout)
+	{
+		return poll(descriptors.data(), (nfds_t)descriptors.size(), timeout);
+	}
+#endif
+
+	// a loopback UDP socket connected to itself, workers returning a connection send a datagram to wake up poll()
+	bool OpenWakeUpSocket()
+	{
+		wakeUp = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (wakeUp == InvalidSocket()) return false;
+
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t addressSize = sizeof(address);
+		if (bind(wakeUp, (const sockaddr*)&address, sizeof(address)) != 0 || getsockname(wakeUp, (sockaddr*)&address, &addressSize) != 0 ||
+			connect(wakeUp, (const sockaddr*)&address, sizeof(address)) != 0)
+		{
+			CloseSocket(wakeUp);
+			wakeUp = InvalidSocket();
+			return false;
+		}
+		return true;
+	}
+
+	// called with m locked, a lost datagram doesn't matter as long as one is pending
+	void WakeUp()
+	{
+		const char message = 0;
+		send(wakeUp, &message, 1, 0);
+	}
+
+	static void SetReceiveTimeout(const TileServerSocket s, const int seconds)
+	{
+#ifdef _WIN32
+		const DWORD timeout = seconds * 1000;
+#else
+		timeval timeout;
+		timeout.tv_sec = seconds;
+		timeout.tv_usec = 0;
+#endif
+		setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+	}
+
+	// more: further data follows immediately, so the kernel doesn't have to send a partial packet
+	static bool Send(const TileServerSocket s, const char* data, size_t size, const bool more)
+	{
+#ifdef _WIN32
+		const int flags = 0;
+#elif defined(__linux__)
+		const int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+#else
+		const int flags = 0;
+#endif
+		while (size > 0)
+		{
+			const int numBytesSent = (int)send(s, data, (int)std::min<size_t>(size, 1 << 30), flags);
+			if (numBytesSent <= 0) return false;
+			data += numBytesSent;
+			size -= numBytesSent;
+		}
+		return true;
+	}
+
+	// accepts connections and waits for requests on idle ones, which are then queued for the workers
+	void Dispatch()
+	{
+		typedef std::unique_ptr<Connection> ConnectionPtr;
+		std::vector<ConnectionPtr> idleConnections;
+#ifdef _WIN32
+		std::vector<WSAPOLLFD> descriptors;
+#else
+		std::vector<pollfd> descriptors;
+#endif
+		bool isAcceptFailing = false;
+
+		while (running)
+		{
+			descriptors.resize(2 + idleConnections.size());
+			descriptors[0].fd = listener;
+			descriptors[1].fd = wakeUp;
+			for (size_t c = 0; c < idleConnections.size(); c++)
+			{
+				descriptors[2 + c].fd = idleConnections[c]->socket;
+			}
+			for (auto& descriptor : descriptors)
+			{
+				descriptor.events = POLLIN;
+				descriptor.revents = 0;
+			}
+
+			// timed out to close idle connections
+			if (Poll(descriptors, 1000) < 0) continue;
+			if (!running) break;
+
+			if (descriptors[1].revents)
+			{
+				char signals[64];
+				recv(wakeUp, signals, sizeof(signals), 0);
+			}
+
+			// connections wait for their first request like idle ones
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			std::vector<ConnectionPtr> readyConnections;
+			for (size_t c = 0; c < idleConnections.size(); c++)
+			{
+				if (descriptors[2 + c].revents)
+				{
+					readyConnections.push_back(std::move(idleConnections[c]));
+				}
+				else if (now - idleConnections[c]->idleSince > std::chrono::seconds(KeepAliveTimeout))
+				{
+					CloseSocket(idleConnections[c]->socket);
+					idleConnections[c].reset();
+				}
+			}
+			idleConnections.erase(std::remove(idleConnections.begin(), idleConnections.end(), nullptr), idleConnections.end());
+
+			if (descriptors[0].revents)
+			{
+				const TileServerSocket client = accept(listener, NULL, NULL);
+				if (client == InvalidSocket())
+				{
+					// out of descriptors the listener stays readable, so poll() would return immediately
+					if (!isAcceptFailing) printf("accept() failed, retrying\n");
+					isAcceptFailing = true;
+					std::this_thread::sleep_for(std::chrono::milliseconds(AcceptRetryDelay));
+				}
+				else
+				{
+					isAcceptFailing = false;
+					const int noDelay = 1;
+					setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+					SetReceiveTimeout(client, KeepAliveTimeout);
+
+					ConnectionPtr connection(new Connection());
+					connection->socket = client;
+					connection->numRequests = 0;
+					connection->idleSince = now;
+					idleConnections.push_back(std::move(connection));
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(m);
+			for (auto& connection : returnedConnections)
+			{
+				connection->idleSince = now;
+				idleConnections.push_back(std::move(connection));
+			}
+			returnedConnections.clear();
+
+			for (auto& connection : readyConnections)
+			{
+				connections.push_back(std::move(connection));
+				connectionAdded.notify_one();
+			}
+		}
+
+		for (auto& connection : idleConnections)
+		{
+			CloseSocket(connection->socket);
+		}
+	}
+
+	void Work()
+	{
+		Worker worker;
+		if (generation.storage)
+		{
+			worker.builder.reset(new VectorTileBuilder(*generation.storage, *generation.zoomBands, *generation.wayStore,
+				*generation.tagDictionary, *generation.layerDefinitions));
+		}
+
+		while (true)
+		{
+			std::unique_ptr<Connection> connection;
+			{
+				std::unique_lock<std::mutex> lock(m);
+				connectionAdded.wait(lock, [this]() { return !running || !connections.empty(); });
+				if (!running) return;
+
+				connection = std::move(connections.front());
+				connections.pop_front();
+			}
+
+			const bool keepAlive = Serve(worker, *connection);
+
+			std::lock_guard<std::mutex> lock(m);
+			if (!keepAlive || !running)
+			{
+				CloseSocket(connection->socket);
+				continue;
+			}
+			returnedConnections.push_back(std::move(connection));
+			WakeUp();
+		}
+	}
+
+	// serves the requests received so far, false if the connection is closed
+	bool Serve(Worker& worker, Connection& connection)
+	{
+		// poll() reported data, so this doesn't block
+		char buffer[4096];
+		const int numBytesReceived = (int)recv(connection.socket, buffer, sizeof(buffer), 0);
+		if (numBytesReceived <= 0) return false; // closed by the client
+		connection.received.append(buffer, numBytesReceived);
+
+		// a partial request waits for more data like an idle connection
+		size_t headerEnd;
+		while ((headerEnd = connection.received.find("\r\n\r\n")) != std::string::npos)
+		{
+			const std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+
+			Request request;
+			const bool isValid = ParseRequest(connection.received, headerEnd, request);
+			connection.received.erase(0, headerEnd + 4); // pipelined requests stay
+			const bool keepAlive = isValid && request.keepAlive && !request.hasBody && ++connection.numRequests < MaxRequestsPerConnection;
+
+			Endpoint endpoint = EndpointError;
+			bool sent;
+			if (!isValid || request.hasBody)
+			{
+				sent = SendResponse(worker, connection.socket, 400, "Bad Request", false, "text/plain", "", 0, keepAlive);
+			}
+			else if (request.method != "GET" && request.method != "HEAD")
+			{
+				sent = SendResponse(worker, connection.socket, 405, "Method Not Allowed", false, "text/plain", "", 0, keepAlive);
+			}
+			else
+			{
+				sent = Route(worker, connection.socket, request, keepAlive, endpoint);
+			}
+
+			histograms[endpoint].Record(std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - t1).count());
+			if (!sent || !keepAlive || !running) return false;
+		}
+		return connection.received.size() <= MaxRequestSize;
+	}
+
+	bool Route(Worker& worker, const TileServerSocket client, const Request& request, const bool keepAlive, Endpoint& endpoint)
+	{
+		const bool isHead = request.method == "HEAD";
+		const std::string target = request.target.substr(0, request.target.find('?'));
+
+		if (target == "/stats")
+		{
+			endpoint = EndpointStats;
+			const std::string statistics = GetStatistics();
+			return SendResponse(worker, client, 200, "OK", isHead, "text/plain", statistics.data(), statistics.size(), keepAlive);
+		}
+
+		TileCoord tile;
+		int length = 0;
+		if (sscanf(target.c_str(), "/%d/%d/%d.mvt%n", &tile.zoom, &tile.x, &tile.y, &length) != 3 || length != (int)target.size() ||
+			tile.zoom < 0 || tile.zoom > MaxZoom || tile.x < 0 || tile.y < 0 || tile.x >= (1 << tile.zoom) || tile.y >= (1 << tile.zoom))
+		{
+			return SendResponse(worker, client, 404, "Not Found", isHead, "text/plain", "", 0, keepAlive);
+		}
+
+		TileArchiveEntry entry;
+		if (archive && archive->FindTile(tile.zoom, tile.x, tile.y, entry))
+		{
+			endpoint = EndpointArchive;
+#ifdef __linux__
+			if (archive->GetCompression() == TileArchiveCompressionNone)
+			{
+				return SendArchivedTile(worker, client, entry, isHead, keepAlive);
+			}
+#endif
+			if (!archive->ReadTile(tile.zoom, tile.x, tile.y, worker.tile))
+			{
+				endpoint = EndpointError;
+				return SendResponse(worker, client, 500, "Internal Server Error", isHead, "text/plain", "", 0, keepAlive);
+			}
+			return SendTile(worker, client, worker.tile.data(), worker.tile.size(), isHead, keepAlive);
+		}
+
+		// not in the archive: empty, or outside of the archived pyramid
+		if (!cache) return SendResponse(worker, client, 204, "No Content", isHead, "", "", 0, keepAlive);
+
+		endpoint = EndpointOnDemand;
+		TileCache::Tile data;
+		try
+		{
+			data = cache->Get(tile, generation.indexVersion, [&](std::string& built)
+			{
+				worker.builder->BuildTile(tile.zoom, tile.x, tile.y, worker.writer);
+				built.assign(worker.writer.GetData(), worker.writer.GetSize());
+			});
+		}
+		catch (...) // any failure of a single tile must not take down the server
+		{
+			endpoint = EndpointError;
+			return SendResponse(worker, client, 500, "Internal Server Error", isHead, "text/plain", "", 0, keepAlive);
+		}
+		return SendTile(worker, client, data->data(), data->size(), isHead, keepAlive);
+	}
+
+	bool SendTile(Worker& worker, const TileServerSocket client, const char* data, const size_t size, const bool isHead, const bool keepAlive)
+	{
+		if (size == 0) return SendResponse(worker, client, 204, "No Content", isHead, "", "", 0, keepAlive);
+		return SendResponse(worker, client, 200, "OK", isHead, "application/vnd.mapbox-vector-tile", data, size, keepAlive);
+	}
+
+#ifdef __linux__
+	// zero-copy from the page cache
+	bool SendArchivedTile(Worker& worker, const TileServerSocket client, const TileArchiveEntry& entry, const bool isHead, const bool keepAlive)
+	{
+		FormatHeader(worker.header, 200, "OK", "application/vnd.mapbox-vector-tile", entry.length, keepAlive);
+		if (!Send(client, worker.header.data(), worker.header.size(), !isHead)) return false;
+		if (isHead) return true;
+
+		off_t offset = (off_t)entry.offset;
+		size_t remaining = entry.length;
+		while (remaining > 0)
+		{
+			const ssize_t numBytesSent = sendfile(client, archive->GetFileDescriptor(), &offset, remaining);
+			if (numBytesSent <= 0) return false;
+			remaining -= (size_t)numBytesSent;
+		}
+		return true;
+	}
+#endif
+
+	bool SendResponse(Worker& worker, const TileServerSocket client, const int status, const char* reason, const bool isHead,
+		const char* contentType, const char* data, const size_t size, const bool keepAlive)
+	{
+		FormatHeader(worker.header, status, reason, contentType, size, keepAlive);
+		const bool hasBody = !isHead && status != 204 && size > 0;
+		if (!Send(client, worker.header.data(), worker.header.size(), hasBody)) return false;
+		return !hasBody || Send(client, data, size, false);
+	}
+
+	static void FormatHeader(std::string& header, const int status, const char* reason, const char* contentType, const size_t size, const bool keepAlive)
+	{
+		char line[128];
+		snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", status, reason);
+		header = line;
+		if (*contentType)
+		{
+			header += "Content-Type: ";
+			header += contentType;
+			header += "\r\n";
+		}
+		if (status != 204)
+		{
+			snprintf(line, sizeof(line), "Content-Length: %llu\r\n", (unsigned long long)size);
+			header += line;
+		}
+		header += "Access-Control-Allow-Origin: *\r\n";
+		header += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+	}
+
+	// request line and the headers deciding about the connection, false if malformed
+	static bool ParseRequest(const std::string& data, const size_t headerEnd, Request& request)
+	{
+		const size_t lineEnd = data.find("\r\n");
+		const size_t methodEnd = data.find(' ');
+		const size_t targetEnd = methodEnd < lineEnd ? data.find(' ', methodEnd + 1) : std::string::npos;
+		if (targetEnd >= lineEnd) return false;
+
+		request.method = data.substr(0, methodEnd);
+		request.target = data.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+		const std::string version = data.substr(targetEnd + 1, lineEnd - targetEnd - 1);
+		if (version.compare(0, 5, "HTTP/") != 0) return false;
+
+		request.keepAlive = version != "HTTP/1.0";
+		request.hasBody = false;
+
+		for (size_t begin = lineEnd + 2; begin < headerEnd;)
+		{
+			const size_t end = data.find("\r\n", begin);
+			std::string field = data.substr(begin, end - begin);
+			begin = end + 2;
+
+			std::transform(field.begin(), field.end(), field.begin(), ::tolower);
+			const size_t colon = field.find(':');
+			if (colon == std::string::npos) return false;
+
+			const std::string name = field.substr(0, colon);
+			const size_t valueBegin = field.find_first_not_of(" \t", colon + 1);
+			const std::string value = valueBegin == std::string::npos ? "" : field.substr(valueBegin);
+			if (name == "connection")
+			{
+				if (value.find("close") != std::string::npos) request.keepAlive = false;
+				else if (value.find("keep-alive") != std::string::npos) request.keepAlive = true;
+			}
+			else if ((name == "content-length" && atoi(value.c_str()) != 0) || name == "transfer-encoding")
+			{
+				request.hasBody = true; // not supported, the connection is closed after the response
+			}
+		}
+		return true;
+	}
+
+	const int numThreads;
+	const TileArchiveReader* archive;
+	OnDemandGeneration generation;
+	std::unique_ptr<TileCache> cache;
+
+	TileServerSocket listener;
+	TileServerSocket wakeUp;
+	std::atomic<bool> running;
+	std::mutex m;
+	std::condition_variable connectionAdded;
+	std::deque<std::unique_ptr<Connection>> connections; // requests received, waiting for a worker
+	std::vector<std::unique_ptr<Connection>> returnedConnections; // served, handed back to poll() by Dispatch()
+
+	LatencyHistogram histograms[NumEndpoints];
+};
+
+#endif // __TILESERVER_H__
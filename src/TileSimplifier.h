@@ -0,0 +1,248 @@
+#ifndef __TILESIMPLIFIER_H__
+#define __TILESIMPLIFIER_H__
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <limits>
+
+#include <ZFXMath.h>
+
+#include "ZoomBands.h"
+
+enum SimplificationMethod
+{
+	SimplifyNone,
+	SimplifyDouglasPeucker,
+	SimplifyVisvalingam,
+};
+
+// Simplification is done in tile space, so the same tolerance removes more detail (in degrees) at lower zooms.
+// From maxZoom on all vertices are kept, tiles of that zoom are overzoomed by clients.
+struct TileSimplification
+{
+	SimplificationMethod method;
+	double tolerance;	// tile units, Douglas-Peucker: max. distance, Visvalingam: min. triangle area is tolerance^2
+	int maxZoom;
+
+	static TileSimplification CreateDefault(const uint32_t extent)
+	{
+		TileSimplification simplification;
+		simplification.method = SimplifyDouglasPeucker;
+		simplification.tolerance = 0.5 * extent / 256.0; // half a pixel of a 256 pixel tile
+		simplification.maxZoom = MaxZoom;
+		return simplification;
+	}
+
+	double GetTolerance(const int zoom) const
+	{
+		return (method == SimplifyNone || zoom >= maxZoom) ? 0.0 : tolerance;
+	}
+};
+
+// Simplifies lines and rings (without closing vertex) of tile geometry in place.
+// End points of lines are kept. Rings which collapse (less than 3 vertices, no area or flipped orientation) are reported
+// as degenerated, so they can be dropped.
+// Holds scratch buffers, so each thread needs its own simplifier.
+class TileSimplifier
+{
+	typedef ZFXMath::TPolygon2D<int32_t> Ring;
+	typedef ZFXMath::TVector2D<int32_t> Vertex;
+
+	struct Triangle
+	{
+		double area;
+		int vertex;
+
+		bool operator<(const Triangle& other) const { return area > other.area; } // smallest area on top
+	};
+
+public:
+	// false if the part degenerated
+	bool Simplify(Ring& part, const bool isRing, const SimplificationMethod method, const double tolerance)
+	{
+		const int numVertices = part.GetNumVertices();
+		const int minNumVertices = isRing ? 3 : 2;
+		if (tolerance <= 0.0 || method == SimplifyNone || numVertices <= minNumVertices) return IsValid(part, isRing, 0);
+
+		const int64_t area = isRing ? part.ComputeArea<int64_t>() : 0;
+
+		keep.assign(numVertices, 0);
+		if (method == SimplifyVisvalingam)
+		{
+			Visvalingam(part.GetVertices(), numVertices, isRing, tolerance * tolerance);
+		}
+		else if (isRing)
+		{
+			// split the ring at the vertex farthest from the first one into two lines
+			const Vertex* vertices = part.GetVertices();
+			int farthest = 1;
+			double maxSqrDistance = -1.0;
+			for (int v = 1; v < numVertices; v++)
+			{
+				const double sqrDistance = GetSqrDistance(vertices[v], vertices[0]);
+				if (sqrDistance > maxSqrDistance)
+				{
+					farthest = v;
+					maxSqrDistance = sqrDistance;
+				}
+			}
+			DouglasPeucker(vertices, 0, farthest, tolerance * tolerance);
+			DouglasPeucker(vertices, farthest, numVertices, tolerance * tolerance);
+		}
+		else
+		{
+			DouglasPeucker(part.GetVertices(), 0, numVertices - 1, tolerance * tolerance);
+		}
+
+		Vertex* vertices = part.GetVertices();
+		int numKept = 0;
+		for (int v = 0; v < numVertices; v++)
+		{
+			if (keep[v]) vertices[numKept++] = vertices[v];
+		}
+		part.SetNumVertices(numKept);
+
+		return IsValid(part, isRing, area);
+	}
+
+private:
+	static bool IsValid(const Ring& part, const bool isRing, const int64_t originalArea)
+	{
+		const int numVertices = part.GetNumVertices();
+		const Vertex* vertices = part.GetVertices();
+		if (!isRing) return numVertices >= 2 && (numVertices > 2 || vertices[0].x != vertices[1].x || vertices[0].y != vertices[1].y);
+		if (numVertices < 3) return false;
+
+		const int64_t area = part.ComputeArea<int64_t>();
+		return area != 0 && (originalArea == 0 || (area < 0) == (originalArea < 0));
+	}
+
+	static double GetSqrDistance(const Vertex& a, const Vertex& b)
+	{
+		const double dx = (double)b.x - a.x;
+		const double dy = (double)b.y - a.y;
+		return dx * dx + dy * dy;
+	}
+
+	static double GetSqrSegmentDistance(const Vertex& p, const Vertex& a, const Vertex& b)
+	{
+		const double dx = (double)b.x - a.x;
+		const double dy = (double)b.y - a.y;
+		const double lengthSqr = dx * dx + dy * dy;
+		if (lengthSqr == 0.0) return GetSqrDistance(p, a);
+
+		const double t = std::max(0.0, std::min(1.0, (((double)p.x - a.x) * dx + ((double)p.y - a.y) * dy) / lengthSqr));
+		const double x = a.x + t * dx - p.x;
+		const double y = a.y + t * dy - p.y;
+		return x * x + y * y;
+	}
+
+	// keeps first and last and all vertices in between needed to stay within the tolerance,
+	// last == numVertices of a ring refers to vertex 0
+	void DouglasPeucker(const Vertex* vertices, const int first, const int last, const double sqrTolerance)
+	{
+		const int numVertices = (int)keep.size();
+		keep[first] = 1;
+		keep[last % numVertices] = 1;
+
+		ranges.clear();
+		ranges.push_back(std::make_pair(first, last));
+		while (!ranges.empty())
+		{
+			const int a = ranges.back().first;
+			const int b = ranges.back().second;
+			ranges.pop_back();
+
+			int farthest = -1;
+			double maxSqrDistance = sqrTolerance;
+			for (int v = a + 1; v < b; v++)
+			{
+				const double sqrDistance = GetSqrSegmentDistance(vertices[v], vertices[a], vertices[b % numVertices]);
+				if (sqrDistance > maxSqrDistance)
+				{
+					farthest = v;
+					maxSqrDistance = sqrDistance;
+				}
+			}
+
+			if (farthest >= 0)
+			{
+				keep[farthest] = 1;
+				ranges.push_back(std::make_pair(a, farthest));
+				ranges.push_back(std::make_pair(farthest, b));
+			}
+		}
+	}
+
+	// removes the vertex with the smallest triangle (with its neighbours) until all are at least minArea,
+	// the area of a triangle never drops below the one of a previously removed triangle
+	void Visvalingam(const Vertex* vertices, const int numVertices, const bool isRing, const double minArea)
+	{
+		previous.resize(numVertices);
+		next.resize(numVertices);
+		areas.resize(numVertices);
+		for (int v = 0; v < numVertices; v++)
+		{
+			previous[v] = v - 1;
+			next[v] = v + 1;
+			keep[v] = 1;
+		}
+		if (isRing)
+		{
+			previous[0] = numVertices - 1;
+			next[numVertices - 1] = 0;
+		}
+
+		triangles = std::priority_queue<Triangle>();
+		for (int v = 0; v < numVertices; v++)
+		{
+			areas[v] = GetTriangleArea(vertices, v);
+			if (areas[v] < minArea) triangles.push(Triangle{ areas[v], v });
+		}
+
+		int numKept = numVertices;
+		const int minNumVertices = isRing ? 3 : 2;
+		while (!triangles.empty() && numKept > minNumVertices)
+		{
+			const Triangle triangle = triangles.top();
+			triangles.pop();
+			if (!keep[triangle.vertex] || triangle.area != areas[triangle.vertex]) continue; // outdated
+
+			const int v = triangle.vertex;
+			keep[v] = 0;
+			numKept--;
+			next[previous[v]] = next[v];
+			previous[next[v]] = previous[v];
+
+			const int neighbours[] = { previous[v], next[v] };
+			for (const int n : neighbours)
+			{
+				areas[n] = std::max(triangle.area, GetTriangleArea(vertices, n));
+				if (areas[n] < minArea) triangles.push(Triangle{ areas[n], n });
+			}
+		}
+	}
+
+	// end points of lines have no triangle and are never removed
+	double GetTriangleArea(const Vertex* vertices, const int v) const
+	{
+		if (previous[v] < 0 || next[v] >= (int)next.size()) return std::numeric_limits<double>::max();
+
+		const Vertex& a = vertices[previous[v]];
+		const Vertex& b = vertices[v];
+		const Vertex& c = vertices[next[v]];
+		return 0.5 * fabs(((double)b.x - a.x) * ((double)c.y - a.y) - ((double)c.x - a.x) * ((double)b.y - a.y));
+	}
+
+	std::vector<uint8_t> keep;
+	std::vector<std::pair<int, int>> ranges;
+	std::vector<int> previous;
+	std::vector<int> next;
+	std::vector<double> areas;
+	std::priority_queue<Triangle> triangles;
+};
+
+#endif // __TILESIMPLIFIER_H__
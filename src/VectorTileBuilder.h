@@ -0,0 +1,516 @@
+#ifndef __VECTORTILEBUILDER_H__
+#define __VECTORTILEBUILDER_H__
+
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+
+#include <spatialindex/SpatialIndex.h>
+#include <ZFXMath.h>
+
+#include "o5mindexer.h"
+#include "PinnedPageStorage.h"
+#include "WayCodec.h"
+#include "WayStore.h"
+#include "TagFilter.h"
+#include "ZoomBands.h"
+#include "MultipolygonAssembler.h"
+#include "MVTWriter.h"
+#include "TileClipper.h"
+#include "TileSimplifier.h"
+#include "vector_tile.pb.h"
+
+const uint32_t DefaultTileExtent = 4096;
+const int32_t DefaultTileBuffer = 64; // geometry is clipped to the extent grown by this on all sides
+
+// MVT geometry commands
+const uint32_t TileCommandMoveTo = 1;
+const uint32_t TileCommandLineTo = 2;
+const uint32_t TileCommandClosePath = 7;
+
+// Ways passing the filter go into the layer, only the attribute keys are written as feature tags (all tags if there are none).
+// A way is put into the first layer it passes.
+struct TileLayerDefinition
+{
+	std::string name;
+	TagFilter filter;
+	std::vector<std::string> attributeKeys;
+};
+
+inline TileLayerDefinition CreateTileLayerDefinition(const std::string& name, const std::string& filterExpression, const std::vector<std::string>& attributeKeys)
+{
+	TileLayerDefinition layer;
+	layer.name = name;
+	layer.filter.Parse(filterExpression);
+	layer.attributeKeys = attributeKeys;
+	return layer;
+}
+
+inline std::vector<TileLayerDefinition> CreateDefaultTileLayerDefinitions()
+{
+	std::vector<TileLayerDefinition> layers;
+	layers.push_back(CreateTileLayerDefinition("water", "natural=water|bay; waterway; landuse=reservoir|basin", { "natural", "waterway", "name" }));
+	layers.push_back(CreateTileLayerDefinition("landuse", "landuse; natural=wood|scrub|grassland|heath|wetland|beach|sand; leisure=park|garden|pitch", { "landuse", "natural", "leisure" }));
+	layers.push_back(CreateTileLayerDefinition("boundaries", "boundary=administrative", { "admin_level", "name" }));
+	layers.push_back(CreateTileLayerDefinition("roads", "highway; railway; aeroway=runway|taxiway", { "highway", "railway", "aeroway", "name", "ref", "bridge", "tunnel", "oneway" }));
+	layers.push_back(CreateTileLayerDefinition("buildings", "building", { "building", "height", "building:levels" }));
+	return layers;
+}
+
+// Web mercator projection of index coordinates (degrees * 10^7) into the integer space of one tile
+class TileProjection
+{
+public:
+	TileProjection(const int zoom, const int tileX, const int tileY, const uint32_t extent)
+		: zoom(zoom)
+		, tileX(tileX)
+		, tileY(tileY)
+		, extent(extent)
+		, scale((double)(1u << zoom) * extent)
+	{
+	}
+
+	ZFXMath::TVector2D<int32_t> Project(const O5MCoord lon, const O5MCoord lat) const
+	{
+		const double Pi = 3.14159265358979323846;
+		const double MaxLatitude = 85.0511287798;
+
+		const double latitude = std::max(-MaxLatitude, std::min(MaxLatitude, lat * 0.0000001)) * Pi / 180.0;
+		const double x = (lon * 0.0000001 + 180.0) / 360.0;
+		const double y = (1.0 - log(tan(latitude) + 1.0 / cos(latitude)) / Pi) / 2.0;
+
+		return ZFXMath::TVector2D<int32_t>(
+			ToInt32(floor(x * scale - (double)tileX * extent + 0.5)),
+			ToInt32(floor(y * scale - (double)tileY * extent + 0.5)));
+	}
+
+	// tile bounds in degrees (lon, lat), grown by buffer tile units on each side
+	void GetBounds(double* low, double* high, const int32_t buffer = 0) const
+	{
+		const double border = (double)buffer / extent;
+		low[0] = TileXToLon(tileX - border);
+		high[0] = TileXToLon(tileX + 1 + border);
+		low[1] = TileYToLat(tileY + 1 + border);
+		high[1] = TileYToLat(tileY - border);
+	}
+
+	// size of one pixel of a 256 pixel tile in degrees
+	double GetPixelSize() const
+	{
+		return 360.0 / (256.0 * (1u << zoom));
+	}
+
+	int GetZoom() const { return zoom; }
+	uint32_t GetExtent() const { return extent; }
+
+private:
+	static int32_t ToInt32(const double value)
+	{
+		return (int32_t)std::max((double)std::numeric_limits<int32_t>::min(), std::min((double)std::numeric_limits<int32_t>::max(), value));
+	}
+
+	double TileXToLon(const double x) const
+	{
+		return (double)x / (1u << zoom) * 360.0 - 180.0;
+	}
+
+	double TileYToLat(const double y) const
+	{
+		const double Pi = 3.14159265358979323846;
+		return atan(sinh(Pi * (1.0 - 2.0 * y / (1u << zoom)))) * 180.0 / Pi;
+	}
+
+	int zoom;
+	int tileX;
+	int tileY;
+	uint32_t extent;
+	double scale;
+};
+
+// Feature in tile space, polygon rings are stored without closing vertex (exterior rings followed by their interiors)
+struct TileFeature
+{
+	uint64_t id;
+	vector_tile::Tile_GeomType type;
+	std::vector<uint32_t> tags;								// key and value indices into the layer
+	std::vector<ZFXMath::TPolygon2D<int32_t>> geometry;		// rings or lines
+};
+
+struct TileLayer
+{
+	std::string name;
+	std::vector<std::string> keys;
+	std::vector<std::string> values;
+	std::unordered_map<std::string, uint32_t> keyIndices;
+	std::unordered_map<std::string, uint32_t> valueIndices;
+	std::vector<TileFeature> features;
+
+	void Clear()
+	{
+		keys.clear();
+		values.clear();
+		keyIndices.clear();
+		valueIndices.clear();
+		features.clear();
+	}
+
+	uint32_t GetKeyIndex(const std::string& key)
+	{
+		return GetIndex(key, keys, keyIndices);
+	}
+
+	uint32_t GetValueIndex(const std::string& value)
+	{
+		return GetIndex(value, values, valueIndices);
+	}
+
+private:
+	static uint32_t GetIndex(const std::string& s, std::vector<std::string>& strings, std::unordered_map<std::string, uint32_t>& indices)
+	{
+		auto it = indices.find(s);
+		if (it != indices.end()) return it->second;
+
+		const uint32_t index = (uint32_t)strings.size();
+		strings.push_back(s);
+		indices.insert(std::make_pair(s, index));
+		return index;
+	}
+};
+
+inline uint32_t EncodeTileCommand(const uint32_t command, const uint32_t count)
+{
+	return (command & 0x7) | (count << 3);
+}
+
+inline uint32_t ZigZagInt32ToUint32(const int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+// MoveTo/LineTo/ClosePath command stream with zigzag encoded deltas (cursor starts at 0, 0 for each feature)
+inline void EncodeTileGeometry(const TileFeature& feature, std::vector<uint32_t>& commands)
+{
+	commands.clear();
+
+	const bool isPolygon = feature.type == vector_tile::Tile_GeomType_POLYGON;
+	int32_t cursorX = 0;
+	int32_t cursorY = 0;
+	for (const auto& part : feature.geometry)
+	{
+		const int numVertices = part.GetNumVertices();
+		const ZFXMath::TVector2D<int32_t>* vertices = part.GetVertices();
+
+		for (int v = 0; v < numVertices; v++)
+		{
+			if (v == 0) commands.push_back(EncodeTileCommand(TileCommandMoveTo, 1));
+			if (v == 1) commands.push_back(EncodeTileCommand(TileCommandLineTo, numVertices - 1));
+
+			commands.push_back(ZigZagInt32ToUint32(vertices[v].x - cursorX));
+			commands.push_back(ZigZagInt32ToUint32(vertices[v].y - cursorY));
+			cursorX = vertices[v].x;
+			cursorY = vertices[v].y;
+		}
+
+		if (isPolygon) commands.push_back(EncodeTileCommand(TileCommandClosePath, 1));
+	}
+}
+
+// Builds vector tiles from the per zoom band way indices and the way store.
+// Holds query state and buffers, so each thread needs its own builder (storage manager and way store can be shared).
+class VectorTileBuilder
+{
+	typedef ZFXMath::TPolygon2D<int32_t> Ring;
+
+	class CollectIds : public IPageEntryVisitor
+	{
+	public:
+		std::vector<uint64_t> ids;
+
+		virtual void visitEntry(const PageEntry& entry)
+		{
+			ids.push_back((uint64_t)entry.id);
+		}
+	};
+
+public:
+	VectorTileBuilder(IPinnedPageStorageManager& storage, const ZoomBandSet& zoomBands, const WayStore& wayStore,
+		const TagDictionary& tagDictionary, const std::vector<TileLayerDefinition>& layerDefinitions, const uint32_t extent = DefaultTileExtent,
+		const int32_t buffer = DefaultTileBuffer)
+		: zoomBands(zoomBands)
+		, wayStore(wayStore)
+		, tagDictionary(tagDictionary)
+		, layerDefinitions(layerDefinitions)
+		, extent(extent)
+		, buffer(buffer)
+		, clipBox(TileClipper::GetClipBox(extent, buffer))
+		, simplification(TileSimplification::CreateDefault(extent))
+		, layers(layerDefinitions.size())
+	{
+		for (const auto& band : zoomBands.bands)
+		{
+			queries.push_back(PinnedRTreeQuery(storage, band.indexId));
+		}
+	}
+
+	void SetSimplification(const TileSimplification& simplification)
+	{
+		this->simplification = simplification;
+	}
+
+	// features of the tile grouped by layer in tile space, valid until the next call
+	const std::vector<TileLayer>& CollectFeatures(const int zoom, const int tileX, const int tileY)
+	{
+		const TileProjection projection(zoom, tileX, tileY, extent);
+
+		for (size_t l = 0; l < layers.size(); l++)
+		{
+			layers[l].Clear();
+			layers[l].name = layerDefinitions[l].name;
+		}
+
+		// features within the buffer are fetched too, they are clipped to clipBox
+		// features smaller than half a pixel are not visible
+		double low[3], high[3];
+		projection.GetBounds(low, high, buffer);
+		low[2] = 0.5 * projection.GetPixelSize();
+		high[2] = std::numeric_limits<double>::max();
+		SpatialIndex::Region queryRegion(low, high, 3);
+
+		collectIds.ids.clear();
+		const size_t numVisibleBands = zoomBands.GetNumBandsVisibleAt(zoom);
+		for (size_t b = 0; b < numVisibleBands && b < queries.size(); b++)
+		{
+			queries[b].intersectsWithQuery(queryRegion, collectIds);
+		}
+
+		for (const uint64_t id : collectIds.ids)
+		{
+			if (!wayStore.Get(id, record)) continue;
+
+			WayRecordView view(record.data(), (uint32_t)record.size(), tagDictionary);
+			view.DecodeTags(way.tags);
+
+			const size_t layerIndex = FindLayer(way.tags);
+			if (layerIndex == layers.size()) continue;
+
+			way.id = view.GetId();
+			way.bbox = view.GetBBox();
+			view.DecodeGeometry(way.polygon, &way.innerRings);
+
+			AddFeature(way, projection, layerDefinitions[layerIndex], layers[layerIndex]);
+		}
+
+		return layers;
+	}
+
+	void BuildTile(const int zoom, const int tileX, const int tileY, vector_tile::Tile& tile)
+	{
+		CollectFeatures(zoom, tileX, tileY);
+
+		tile.Clear();
+		for (const auto& layer : layers)
+		{
+			if (layer.features.empty()) continue;
+
+			vector_tile::Tile_Layer* tileLayer = tile.add_layers();
+			tileLayer->set_version(2);
+			tileLayer->set_name(layer.name);
+			tileLayer->set_extent(extent);
+
+			for (const auto& key : layer.keys)
+			{
+				tileLayer->add_keys(key);
+			}
+			for (const auto& value : layer.values)
+			{
+				tileLayer->add_values()->set_string_value(value);
+			}
+
+			for (const auto& feature : layer.features)
+			{
+				vector_tile::Tile_Feature* tileFeature = tileLayer->add_features();
+				tileFeature->set_id(feature.id);
+				tileFeature->set_type(feature.type);
+				for (const uint32_t tag : feature.tags)
+				{
+					tileFeature->add_tags(tag);
+				}
+
+				EncodeTileGeometry(feature, commands);
+				for (const uint32_t command : commands)
+				{
+					tileFeature->add_geometry(command);
+				}
+			}
+		}
+	}
+
+	// same tile as BuildTile(..., vector_tile::Tile&) but written without protobuf messages (see MVTWriter)
+	void BuildTile(const int zoom, const int tileX, const int tileY, MVTWriter& writer)
+	{
+		CollectFeatures(zoom, tileX, tileY);
+
+		writer.Clear();
+		for (const auto& layer : layers)
+		{
+			if (layer.features.empty()) continue;
+
+			writer.BeginLayer(layer.name);
+			for (const auto& feature : layer.features)
+			{
+				EncodeTileGeometry(feature, commands);
+				writer.AddFeature(feature.id, feature.tags.data(), (uint32_t)feature.tags.size(),
+					feature.type, commands.data(), (uint32_t)commands.size());
+			}
+			writer.EndLayer(layer.keys, layer.values, extent);
+		}
+	}
+
+private:
+	size_t FindLayer(const std::vector<Tag>& tags) const
+	{
+		for (size_t l = 0; l < layerDefinitions.size(); l++)
+		{
+			if (layerDefinitions[l].filter.Matches(tags)) return l;
+		}
+		return layerDefinitions.size();
+	}
+
+	static bool IsArea(const Way& way)
+	{
+		if (IsRelationAreaId(way.id)) return true;
+
+		const int numVertices = way.polygon.GetNumVertices();
+		const ZFXMath::TVector2D<int32_t>* vertices = way.polygon.GetVertices();
+		if (numVertices < 4 || vertices[0].x != vertices[numVertices - 1].x || vertices[0].y != vertices[numVertices - 1].y) return false;
+
+		for (const auto& tag : way.tags)
+		{
+			if (tag.key == "area") return tag.value != "no";
+		}
+		for (const auto& tag : way.tags)
+		{
+			if (tag.key == "highway" || tag.key == "railway" || tag.key == "barrier" || tag.key == "waterway") return false;
+			if (tag.key == "natural" && tag.value == "coastline") return false;
+		}
+		return true;
+	}
+
+	// projects the ring, drops repeated vertices (and the closing vertex of polygon rings)
+	// and orients polygon rings as OutputTile() expects (exterior: ComputeArea() < 0, interior: ComputeArea() > 0)
+	bool ProjectPart(const Ring& source, const TileProjection& projection, const bool isPolygon, const bool isExterior, Ring& target) const
+	{
+		const int numVertices = source.GetNumVertices();
+		const ZFXMath::TVector2D<int32_t>* vertices = source.GetVertices();
+
+		target.SetNumVertices(numVertices);
+		ZFXMath::TVector2D<int32_t>* projected = target.GetVertices();
+		int numProjected = 0;
+		for (int v = 0; v < numVertices; v++)
+		{
+			const ZFXMath::TVector2D<int32_t> vertex = projection.Project(vertices[v].x, vertices[v].y);
+			if (numProjected > 0 && vertex.x == projected[numProjected - 1].x && vertex.y == projected[numProjected - 1].y) continue;
+			projected[numProjected++] = vertex;
+		}
+
+		if (isPolygon && numProjected > 1 && projected[0].x == projected[numProjected - 1].x && projected[0].y == projected[numProjected - 1].y)
+		{
+			numProjected--;
+		}
+		target.SetNumVertices(numProjected);
+
+		if (numProjected < (isPolygon ? 3 : 2)) return false;
+
+		if (isPolygon)
+		{
+			const int64_t area = target.ComputeArea<int64_t>();
+			if (area == 0) return false;
+			if (isExterior ? area > 0 : area < 0)
+			{
+				std::reverse(target.GetVertices(), target.GetVertices() + numProjected);
+			}
+		}
+		return true;
+	}
+
+	// clips the projected part to the tile (plus buffer), simplifies it and appends what is left of it to the geometry
+	bool AddPart(const bool isPolygon, const double tolerance, std::vector<Ring>& geometry)
+	{
+		const size_t numParts = geometry.size();
+		if (isPolygon)
+		{
+			geometry.push_back(Ring());
+			if (!clipper.ClipRing(projected, clipBox, geometry.back())) geometry.pop_back();
+		}
+		else
+		{
+			clipper.ClipLine(projected, clipBox, geometry);
+		}
+
+		for (size_t p = numParts; p < geometry.size();)
+		{
+			if (simplifier.Simplify(geometry[p], isPolygon, simplification.method, tolerance))
+			{
+				p++;
+				continue;
+			}
+			geometry.erase(geometry.begin() + p); // degenerated
+		}
+		return geometry.size() > numParts;
+	}
+
+	void AddFeature(const Way& way, const TileProjection& projection, const TileLayerDefinition& layerDefinition, TileLayer& layer)
+	{
+		TileFeature feature;
+		feature.id = way.id;
+		feature.type = IsArea(way) ? vector_tile::Tile_GeomType_POLYGON : vector_tile::Tile_GeomType_LINESTRING;
+
+		const bool isPolygon = feature.type == vector_tile::Tile_GeomType_POLYGON;
+		const double tolerance = simplification.GetTolerance(projection.GetZoom());
+		if (!ProjectPart(way.polygon, projection, isPolygon, true, projected) || !AddPart(isPolygon, tolerance, feature.geometry)) return;
+
+		for (const auto& innerRing : way.innerRings)
+		{
+			if (ProjectPart(innerRing, projection, isPolygon, false, projected))
+			{
+				AddPart(isPolygon, tolerance, feature.geometry);
+			}
+		}
+
+		for (const auto& tag : way.tags)
+		{
+			const auto& keys = layerDefinition.attributeKeys;
+			if (!keys.empty() && std::find(keys.begin(), keys.end(), tag.key) == keys.end()) continue;
+
+			feature.tags.push_back(layer.GetKeyIndex(tag.key));
+			feature.tags.push_back(layer.GetValueIndex(tag.value));
+		}
+
+		layer.features.push_back(std::move(feature));
+	}
+
+	const ZoomBandSet& zoomBands;
+	const WayStore& wayStore;
+	const TagDictionary& tagDictionary;
+	const std::vector<TileLayerDefinition>& layerDefinitions;
+	const uint32_t extent;
+	const int32_t buffer;
+	const BBox clipBox;
+	TileSimplification simplification;
+
+	std::vector<PinnedRTreeQuery> queries;	// one per zoom band
+	std::vector<TileLayer> layers;
+	CollectIds collectIds;
+	std::string record;
+	Way way;
+	Ring projected;
+	TileClipper clipper;
+	TileSimplifier simplifier;
+	std::vector<uint32_t> commands;
+};
+
+#endif // __VECTORTILEBUILDER_H__
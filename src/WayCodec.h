@@ -0,0 +1,542 @@
+#ifndef __WAYCODEC_H__
+#define __WAYCODEC_H__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <stdexcept>
+#include <string.h>
+
+#include "MGArchive.h"
+#include "o5mindexer.h"
+
+// Dictionary of frequent tag keys and values (e.g. "highway", "building", "yes").
+// A string gets an id as soon as it has been seen MinNumOccurrences times. Ids are never reassigned,
+// so records which have been encoded before a string got its id still decode (they contain the string itself).
+class TagDictionary
+{
+public:
+	static const uint32_t MaxNumStrings = 1 << 16;
+	static const uint32_t MaxStringLength = 32;
+	static const uint32_t MinNumOccurrences = 16;
+	static const uint32_t MaxNumCandidates = 1 << 20;
+
+	bool Find(const std::string& s, uint32_t& id) const
+	{
+		auto it = ids.find(s);
+		if (it == ids.end()) return false;
+
+		id = it->second;
+		return true;
+	}
+
+	bool FindOrLearn(const std::string& s, uint32_t& id)
+	{
+		if (Find(s, id)) return true;
+		if (s.length() > MaxStringLength || strings.size() >= MaxNumStrings) return false;
+
+		auto it = numOccurrences.find(s);
+		if (it == numOccurrences.end())
+		{
+			if (numOccurrences.size() < MaxNumCandidates)
+			{
+				numOccurrences[s] = 1;
+			}
+			return false;
+		}
+		if (++it->second < MinNumOccurrences) return false;
+
+		numOccurrences.erase(it);
+		id = (uint32_t)strings.size();
+		strings.push_back(s);
+		ids[s] = id;
+		AppendToJournal(s);
+		return true;
+	}
+
+	const std::string& GetString(const uint32_t id) const
+	{
+		if (id >= strings.size())
+		{
+			throw std::out_of_range("TagDictionary: unknown string id");
+		}
+		return strings[id];
+	}
+
+	uint32_t GetNumStrings() const { return (uint32_t)strings.size(); }
+
+	bool Load(const std::string& filePath)
+	{
+		FILE* f = fopen(filePath.c_str(), "rb");
+		if (!f) return false;
+
+		fseek(f, 0, SEEK_END);
+		std::vector<char> data((size_t)ftell(f));
+		fseek(f, 0, SEEK_SET);
+		const bool isComplete = fread(data.data(), 1, data.size(), f) == data.size();
+		fclose(f);
+		if (!isComplete) return false;
+
+		MGArchive archive(data.data(), (unsigned int)data.size());
+		strings.resize((size_t)archive.SerializeVarUInt());
+		ids.clear();
+		for (size_t s = 0; s < strings.size(); s++)
+		{
+			const uint64_t length = archive.SerializeVarUInt();
+			strings[s].assign(archive.Skip(length), (size_t)length);
+			ids[strings[s]] = (uint32_t)s;
+		}
+
+		// strings appended by the journal (see OpenJournal()), a torn last one was never handed out
+		while (archive.GetNumBytesLeft() > 0 && IsCompleteEntry(archive.Skip(0), archive.GetNumBytesLeft()))
+		{
+			const uint64_t length = archive.SerializeVarUInt();
+			strings.push_back(std::string(archive.Skip(length), (size_t)length));
+			ids[strings.back()] = (uint32_t)strings.size() - 1;
+		}
+		return true;
+	}
+
+	// Saves the dictionary and appends every string learned from now on to the file before its id is handed out,
+	// so records encoded with the id can always be decoded, even if the final Save() is never reached.
+	bool OpenJournal(const std::string& filePath)
+	{
+		CloseJournal();
+		if (!Save(filePath)) return false;
+
+		journal.reset(fopen(filePath.c_str(), "ab"), [](FILE* f) { if (f) fclose(f); });
+		isJournalValid = journal.get() != NULL;
+		return isJournalValid;
+	}
+
+	void CloseJournal()
+	{
+		journal.reset();
+	}
+
+	// false if a learned string couldn't be written to the journal
+	bool IsJournalValid() const { return isJournalValid; }
+
+	bool Save(const std::string& filePath) const
+	{
+		MGArchive archive;
+		archive.SerializeVarUInt(strings.size());
+		for (const auto& s : strings)
+		{
+			archive.SerializeVarUInt(s.length());
+			archive.Serialize(s.data(), s.length());
+		}
+
+		FILE* f = fopen(filePath.c_str(), "wb");
+		if (!f) return false;
+
+		const bool isComplete = fwrite(archive.GetData(), 1, (size_t)archive.GetSize(), f) == archive.GetSize();
+		fclose(f);
+		return isComplete;
+	}
+
+private:
+	static bool IsCompleteEntry(const char* data, const uint64_t size)
+	{
+		uint64_t length = 0;
+		for (uint64_t b = 0; b < size && b < 10; b++)
+		{
+			length |= (uint64_t)(data[b] & 0x7F) << (7 * b);
+			if ((data[b] & 0x80) == 0) return length <= size - b - 1;
+		}
+		return false;
+	}
+
+	void AppendToJournal(const std::string& s)
+	{
+		if (!journal) return;
+
+		MGArchive archive;
+		archive.SerializeVarUInt(s.length());
+		archive.Serialize(s.data(), s.length());
+		isJournalValid = isJournalValid && fwrite(archive.GetData(), 1, (size_t)archive.GetSize(), journal.get()) == archive.GetSize() &&
+			fflush(journal.get()) == 0;
+	}
+
+	std::vector<std::string> strings;
+	std::unordered_map<std::string, uint32_t> ids;
+	std::unordered_map<std::string, uint32_t> numOccurrences;
+	std::shared_ptr<FILE> journal;
+	bool isJournalValid = true;
+};
+
+// Set of up to 64 "interesting" tag keys. Each way gets a mask of the keys it has, which is stored in the
+// R-tree leaf entry next to the way record, so queries can reject ways by key without looking at the record.
+class TagKeySet
+{
+public:
+	static const uint32_t MaxNumKeys = 64;
+
+	TagKeySet()
+	{
+	}
+
+	TagKeySet(const std::vector<std::string>& keys)
+		: keys(keys)
+	{
+		if (this->keys.size() > MaxNumKeys) this->keys.resize(MaxNumKeys);
+	}
+
+	uint64_t ComputeMask(const std::vector<Tag>& tags) const
+	{
+		uint64_t mask = 0;
+		for (const auto& tag : tags)
+		{
+			uint64_t keyMask;
+			if (GetKeyMask(tag.key, keyMask)) mask |= keyMask;
+		}
+		return mask;
+	}
+
+	// returns false if key is not part of the set
+	bool GetKeyMask(const std::string& key, uint64_t& mask) const
+	{
+		for (size_t k = 0; k < keys.size(); k++)
+		{
+			if (keys[k] == key)
+			{
+				mask = (uint64_t)1 << k;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Load(const std::string& filePath)
+	{
+		FILE* f = fopen(filePath.c_str(), "rb");
+		if (!f) return false;
+
+		keys.clear();
+		char line[256];
+		while (fgets(line, sizeof(line), f) && keys.size() < MaxNumKeys)
+		{
+			std::string key(line);
+			while (!key.empty() && (key.back() == '\n' || key.back() == '\r')) key.pop_back();
+			if (!key.empty()) keys.push_back(key);
+		}
+		fclose(f);
+		return true;
+	}
+
+	bool Save(const std::string& filePath) const
+	{
+		FILE* f = fopen(filePath.c_str(), "wb");
+		if (!f) return false;
+
+		for (const auto& key : keys)
+		{
+			fprintf(f, "%s\n", key.c_str());
+		}
+		fclose(f);
+		return true;
+	}
+
+private:
+	std::vector<std::string> keys;
+};
+
+// Key filter evaluated on the masks of a TagKeySet
+struct TagKeyMaskFilter
+{
+	uint64_t allOf;
+	uint64_t anyOf;
+	uint64_t noneOf;
+
+	bool Matches(const uint64_t mask) const
+	{
+		return (mask & allOf) == allOf && (anyOf == 0 || (mask & anyOf) != 0) && (mask & noneOf) == 0;
+	}
+};
+
+// Compact way record (replaces operator<<(MGArchive&, Way&) for records stored in the index):
+//  version                          uint8
+//  id                               varuint
+//  bbox min x, min y                zigzag varint
+//  bbox width, height               zigzag varint
+//  number of vertices               varuint
+//  number of tags                   varuint
+//  tags (key, value)                string refs
+//  vertices                         zigzag varint deltas (x, y), the first one relative to the bbox min corner
+//  number of inner rings            varuint (areas assembled from multipolygon relations)
+//  inner rings                      varuint number of vertices followed by deltas continuing from the previous vertex
+//
+// string ref: varuint (id << 1 | 1) for dictionary strings, varuint (length << 1) followed by the characters otherwise
+// Tags are stored in front of the vertices, so they can be inspected without decoding the geometry (see WayRecordView).
+const uint8_t CompactWayVersion = 1;
+
+inline void EncodeTagString(MGArchive& archive, const std::string& s, TagDictionary& dictionary)
+{
+	uint32_t id;
+	if (dictionary.FindOrLearn(s, id))
+	{
+		archive.SerializeVarUInt(((uint64_t)id << 1) | 1);
+	}
+	else
+	{
+		archive.SerializeVarUInt((uint64_t)s.length() << 1);
+		archive.Serialize(s.data(), s.length());
+	}
+}
+
+inline void DecodeTagString(MGArchive& archive, std::string& s, const TagDictionary& dictionary)
+{
+	const uint64_t ref = archive.SerializeVarUInt();
+	if (ref & 1)
+	{
+		s = dictionary.GetString((uint32_t)(ref >> 1));
+	}
+	else
+	{
+		const uint64_t length = ref >> 1;
+		s.assign(archive.Skip(length), (size_t)length);
+	}
+}
+
+inline void EncodeWay(MGArchive& archive, Way& way, TagDictionary& dictionary)
+{
+	archive.Serialize(CompactWayVersion);
+	archive.SerializeVarUInt(way.id);
+
+	archive.SerializeVarInt(way.bbox.minX);
+	archive.SerializeVarInt(way.bbox.minY);
+	archive.SerializeVarInt((int64_t)way.bbox.maxX - way.bbox.minX);
+	archive.SerializeVarInt((int64_t)way.bbox.maxY - way.bbox.minY);
+
+	const int numVertices = way.polygon.GetNumVertices();
+	const ZFXMath::TVector2D<int32_t>* vertices = way.polygon.GetVertices();
+	archive.SerializeVarUInt(numVertices);
+
+	archive.SerializeVarUInt(way.tags.size());
+	for (const auto& tag : way.tags)
+	{
+		EncodeTagString(archive, tag.key, dictionary);
+		EncodeTagString(archive, tag.value, dictionary);
+	}
+
+	int64_t prevX = way.bbox.minX;
+	int64_t prevY = way.bbox.minY;
+	for (int v = 0; v < numVertices; v++)
+	{
+		archive.SerializeVarInt(vertices[v].x - prevX);
+		archive.SerializeVarInt(vertices[v].y - prevY);
+		prevX = vertices[v].x;
+		prevY = vertices[v].y;
+	}
+
+	archive.SerializeVarUInt(way.innerRings.size());
+	for (const auto& ring : way.innerRings)
+	{
+		const int numRingVertices = ring.GetNumVertices();
+		const ZFXMath::TVector2D<int32_t>* ringVertices = ring.GetVertices();
+		archive.SerializeVarUInt(numRingVertices);
+		for (int v = 0; v < numRingVertices; v++)
+		{
+			archive.SerializeVarInt(ringVertices[v].x - prevX);
+			archive.SerializeVarInt(ringVertices[v].y - prevY);
+			prevX = ringVertices[v].x;
+			prevY = ringVertices[v].y;
+		}
+	}
+}
+
+// Tag key resolved against the dictionary once, so it can be compared against many records cheaply
+class TagKey
+{
+public:
+	TagKey(const std::string& key, const TagDictionary& dictionary)
+		: key(key)
+		, id(0)
+		, hasId(dictionary.Find(key, id))
+	{
+	}
+
+	bool Matches(const uint64_t ref, const char* literal) const
+	{
+		if (ref & 1) return hasId && (ref >> 1) == id;
+		return (ref >> 1) == key.length() && memcmp(literal, key.data(), key.length()) == 0;
+	}
+
+private:
+	std::string key;
+	uint32_t id;
+	bool hasId;
+};
+
+// Read only view of an encoded way record.
+// Only the record header (id, bbox, counts) is decoded on construction, tags and geometry are read on demand.
+// The record data has to outlive the view.
+class WayRecordView
+{
+public:
+	WayRecordView(const char* data, const uint32_t length, const TagDictionary& dictionary)
+		: dictionary(dictionary)
+		, data(data)
+		, length(length)
+	{
+		MGArchive archive(data, length);
+		if (archive.Serialize<uint8_t>() != CompactWayVersion)
+		{
+			throw std::runtime_error("WayRecordView: unsupported way record version");
+		}
+
+		id = archive.SerializeVarUInt();
+
+		bbox.minX = (O5MCoord)archive.SerializeVarInt();
+		bbox.minY = (O5MCoord)archive.SerializeVarInt();
+		bbox.maxX = (O5MCoord)(bbox.minX + archive.SerializeVarInt());
+		bbox.maxY = (O5MCoord)(bbox.minY + archive.SerializeVarInt());
+
+		numVertices = (int)archive.SerializeVarUInt();
+		numTags = (uint32_t)archive.SerializeVarUInt();
+
+		tagsOffset = length - (uint32_t)archive.GetNumBytesLeft();
+		verticesOffset = 0;
+	}
+
+	uint64_t GetId() const { return id; }
+	const BBox& GetBBox() const { return bbox; }
+	int GetNumVertices() const { return numVertices; }
+	uint32_t GetNumTags() const { return numTags; }
+
+	bool HasKey(const TagKey& key) const
+	{
+		return FindTag(key, NULL);
+	}
+
+	bool FindValue(const TagKey& key, std::string& value) const
+	{
+		return FindTag(key, &value);
+	}
+
+	void DecodeTags(std::vector<Tag>& tags) const
+	{
+		MGArchive archive(data + tagsOffset, length - tagsOffset);
+		tags.resize(numTags);
+		for (auto& tag : tags)
+		{
+			DecodeTagString(archive, tag.key, dictionary);
+			DecodeTagString(archive, tag.value, dictionary);
+		}
+	}
+
+	// outer ring (or line) only
+	void DecodeGeometry(ZFXMath::TPolygon2D<int32_t>& polygon) const
+	{
+		DecodeGeometry(polygon, NULL);
+	}
+
+	void DecodeGeometry(ZFXMath::TPolygon2D<int32_t>& polygon, std::vector<ZFXMath::TPolygon2D<int32_t>>* innerRings) const
+	{
+		MGArchive archive(data + GetVerticesOffset(), length - GetVerticesOffset());
+
+		int64_t x = bbox.minX;
+		int64_t y = bbox.minY;
+		DecodeRing(archive, numVertices, x, y, polygon);
+
+		if (innerRings == NULL) return;
+
+		innerRings->resize((size_t)archive.SerializeVarUInt());
+		for (auto& ring : *innerRings)
+		{
+			DecodeRing(archive, (int)archive.SerializeVarUInt(), x, y, ring);
+		}
+	}
+
+	void Decode(Way& way) const
+	{
+		way.id = id;
+		way.bbox = bbox;
+		DecodeTags(way.tags);
+		DecodeGeometry(way.polygon, &way.innerRings);
+	}
+
+private:
+	static void DecodeRing(MGArchive& archive, const int numRingVertices, int64_t& x, int64_t& y, ZFXMath::TPolygon2D<int32_t>& ring)
+	{
+		ring.SetNumVertices(numRingVertices);
+		ZFXMath::TVector2D<int32_t>* vertices = ring.GetVertices();
+		for (int v = 0; v < numRingVertices; v++)
+		{
+			x += archive.SerializeVarInt();
+			y += archive.SerializeVarInt();
+			vertices[v] = ZFXMath::TVector2D<int32_t>((int32_t)x, (int32_t)y);
+		}
+	}
+
+	bool FindTag(const TagKey& key, std::string* value) const
+	{
+		MGArchive archive(data + tagsOffset, length - tagsOffset);
+		for (uint32_t t = 0; t < numTags; t++)
+		{
+			const uint64_t keyRef = archive.SerializeVarUInt();
+			const char* keyLiteral = (keyRef & 1) ? NULL : archive.Skip(keyRef >> 1);
+			const bool isMatch = key.Matches(keyRef, keyLiteral);
+
+			if (isMatch && value == NULL) return true;
+
+			const uint64_t valueRef = archive.SerializeVarUInt();
+			if (isMatch)
+			{
+				if (valueRef & 1) *value = dictionary.GetString((uint32_t)(valueRef >> 1));
+				else value->assign(archive.Skip(valueRef >> 1), (size_t)(valueRef >> 1));
+				return true;
+			}
+			if ((valueRef & 1) == 0) archive.Skip(valueRef >> 1);
+		}
+		return false;
+	}
+
+	uint32_t GetVerticesOffset() const
+	{
+		if (verticesOffset == 0)
+		{
+			MGArchive archive(data + tagsOffset, length - tagsOffset);
+			for (uint32_t s = 0; s < 2 * numTags; s++)
+			{
+				const uint64_t ref = archive.SerializeVarUInt();
+				if ((ref & 1) == 0) archive.Skip(ref >> 1);
+			}
+			verticesOffset = length - (uint32_t)archive.GetNumBytesLeft();
+		}
+		return verticesOffset;
+	}
+
+	const TagDictionary& dictionary;
+	const char* data;
+	uint32_t length;
+
+	uint64_t id;
+	BBox bbox;
+	int numVertices;
+	uint32_t numTags;
+	uint32_t tagsOffset;
+	mutable uint32_t verticesOffset;
+};
+
+inline void DecodeWay(MGArchive& archive, Way& way, const TagDictionary& dictionary)
+{
+	const uint32_t length = (uint32_t)archive.GetNumBytesLeft();
+	WayRecordView(archive.Skip(length), length, dictionary).Decode(way);
+}
+
+// R-tree leaf data: varuint tag key mask (see TagKeySet), the way record itself is kept in the WayStore
+inline void EncodeLeafData(MGArchive& archive, const Way& way, const TagKeySet& interestingKeys)
+{
+	archive.SerializeVarUInt(interestingKeys.ComputeMask(way.tags));
+}
+
+inline uint64_t DecodeLeafTagKeyMask(const char* data, const uint32_t length)
+{
+	MGArchive archive(data, length);
+	return archive.SerializeVarUInt();
+}
+
+#endif // __WAYCODEC_H__
@@ -0,0 +1,89 @@
+#ifndef __WAYSTORE_H__
+#define __WAYSTORE_H__
+
+#include <string>
+#include <stdint.h>
+
+#include <leveldb/db.h>
+#include <leveldb/write_batch.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/cache.h>
+
+#include "LevelDBKeys.h"
+
+// Way records (see EncodeWay()) keyed by way id.
+// Writes are batched, reads are thread-safe (as long as no writes happen concurrently).
+// The store must not be used if it couldn't be opened (see IsOpen()).
+class WayStore
+{
+	static const size_t WriteBatchSize = 4 << 20;
+
+public:
+	WayStore(const std::string& filePath)
+		: db(NULL)
+		, numBytesInBatch(0)
+	{
+		options.create_if_missing = true;
+		options.write_buffer_size = 32 << 20;
+		options.block_cache = leveldb::NewLRUCache(64 << 20);
+		options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+		if (!leveldb::DB::Open(options, filePath, &db).ok())
+		{
+			db = NULL;
+		}
+	}
+
+	~WayStore()
+	{
+		Flush();
+
+		delete db;
+		delete options.block_cache;
+		delete options.filter_policy;
+	}
+
+	bool IsOpen() const { return db != NULL; }
+
+	void Put(const uint64_t wayId, const char* record, const uint32_t length)
+	{
+		writeBatch.Put(BigEndianKey(wayId).ToSlice(), leveldb::Slice(record, length));
+
+		numBytesInBatch += length;
+		if (numBytesInBatch > WriteBatchSize)
+		{
+			Flush();
+		}
+	}
+
+	bool Get(const uint64_t wayId, std::string& record) const
+	{
+		leveldb::ReadOptions ro;
+		return db->Get(ro, BigEndianKey(wayId).ToSlice(), &record).ok();
+	}
+
+	void Flush()
+	{
+		if (numBytesInBatch == 0 || !db) return;
+
+		leveldb::WriteOptions wo;
+		db->Write(wo, &writeBatch);
+		writeBatch.Clear();
+		numBytesInBatch = 0;
+	}
+
+	// iterates all ways in id order, the iterator has to be deleted by the caller
+	leveldb::Iterator* NewIterator() const
+	{
+		leveldb::ReadOptions ro;
+		ro.fill_cache = false;
+		return db->NewIterator(ro);
+	}
+
+private:
+	leveldb::DB* db;
+	leveldb::Options options;
+	leveldb::WriteBatch writeBatch;
+	size_t numBytesInBatch;
+};
+
+#endif // __WAYSTORE_H__
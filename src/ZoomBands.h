@@ -0,0 +1,139 @@
+#ifndef __ZOOMBANDS_H__
+#define __ZOOMBANDS_H__
+
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <spatialindex/SpatialIndex.h>
+
+#include "o5mindexer.h"
+
+const int MaxZoom = 18;
+
+// Ways are partitioned into one R-tree per zoom band. A way is put into the band of the lowest zoom level it is
+// visible at (see ComputeMinZoom()), so a query for zoom level z only has to look at the trees of bands starting at or below z.
+// Low zoom tiles thereby only traverse the (small) trees of large or important features.
+struct ZoomBand
+{
+	int minZoom;
+	int maxZoom;
+	SpatialIndex::id_type indexId; // header page of the band's R-tree within the shared storage manager
+};
+
+class ZoomBandSet
+{
+public:
+	std::vector<ZoomBand> bands;
+
+	static ZoomBandSet CreateDefault()
+	{
+		ZoomBandSet bandSet;
+		bandSet.bands.push_back(ZoomBand{ 0, 5, -1 });
+		bandSet.bands.push_back(ZoomBand{ 6, 9, -1 });
+		bandSet.bands.push_back(ZoomBand{ 10, 12, -1 });
+		bandSet.bands.push_back(ZoomBand{ 13, MaxZoom, -1 });
+		return bandSet;
+	}
+
+	// index of band containing zoom
+	size_t FindBand(int zoom) const
+	{
+		for (size_t b = 0; b < bands.size(); b++)
+		{
+			if (zoom <= bands[b].maxZoom) return b;
+		}
+		return bands.size() - 1;
+	}
+
+	// number of bands (starting with the first one) which have to be queried for the given zoom
+	size_t GetNumBandsVisibleAt(int zoom) const
+	{
+		return FindBand(zoom) + 1;
+	}
+
+	bool Load(const std::string& filePath)
+	{
+		FILE* f = fopen(filePath.c_str(), "r");
+		if (!f) return false;
+
+		bands.clear();
+		int minZoom, maxZoom;
+		long long indexId;
+		while (fscanf(f, "%d %d %lld", &minZoom, &maxZoom, &indexId) == 3)
+		{
+			bands.push_back(ZoomBand{ minZoom, maxZoom, (SpatialIndex::id_type)indexId });
+		}
+		fclose(f);
+		return !bands.empty();
+	}
+
+	bool Save(const std::string& filePath) const
+	{
+		FILE* f = fopen(filePath.c_str(), "w");
+		if (!f) return false;
+
+		for (const auto& band : bands)
+		{
+			fprintf(f, "%d %d %lld\n", band.minZoom, band.maxZoom, (long long)band.indexId);
+		}
+		fclose(f);
+		return true;
+	}
+};
+
+// features which are shown earlier than their size suggests
+struct TagClassMinZoom
+{
+	const char* key;
+	const char* value; // NULL matches any value
+	int minZoom;
+};
+
+const TagClassMinZoom DefaultTagClassMinZooms[] =
+{
+	{ "natural", "coastline", 0 },
+	{ "boundary", "administrative", 2 },
+	{ "highway", "motorway", 5 },
+	{ "highway", "trunk", 6 },
+	{ "waterway", "river", 6 },
+	{ "railway", "rail", 8 },
+	{ "highway", "primary", 8 },
+	{ "aeroway", "runway", 10 },
+};
+
+// lowest zoom level at which a way is at least MinFeatureSizeInPixels large (256 pixel tiles) or its tag class is shown
+inline int ComputeMinZoom(const BBox& bbox, const std::vector<Tag>& tags)
+{
+	const double MinFeatureSizeInPixels = 2.0;
+	const double CoordToDegree = 0.0000001;
+
+	const double extent = std::max((double)bbox.maxX - bbox.minX, (double)bbox.maxY - bbox.minY) * CoordToDegree; // may exceed int32 (> 214.7 degrees)
+	int minZoom = MaxZoom;
+	if (extent > 0.0)
+	{
+		// extent / 360 * 256 * 2^zoom >= MinFeatureSizeInPixels
+		const double zoom = log2(MinFeatureSizeInPixels * 360.0 / (256.0 * extent));
+		minZoom = std::min(std::max((int)ceil(zoom), 0), MaxZoom);
+	}
+
+	for (const auto& tagClass : DefaultTagClassMinZooms)
+	{
+		if (tagClass.minZoom >= minZoom) continue;
+
+		for (const auto& tag : tags)
+		{
+			if (tag.key == tagClass.key && (tagClass.value == NULL || tag.value == tagClass.value))
+			{
+				minZoom = tagClass.minZoom;
+				break;
+			}
+		}
+	}
+
+	return minZoom;
+}
+
+#endif // __ZOOMBANDS_H__
@@ -4,12 +4,19 @@
 #include <chrono>
 #include <algorithm>
 #include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <stdexcept>
 #include <filesystem>
 
+#include <sys/stat.h>
+
 #include "o5mreader.h"
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
-#include <leveldb/comparator.h>
 #include <leveldb/filter_policy.h>
 
 #include <spatialindex/SpatialIndex.h>
@@ -17,7 +24,20 @@
 #include <ZFXMath.h>
 
 #include "MGArchive.h"
+#include "PinnedPageStorage.h"
 #include "o5mindexer.h"
+#include "WayCodec.h"
+#include "LevelDBKeys.h"
+#include "IdBitmap.h"
+#include "WayStore.h"
+#include "TagFilter.h"
+#include "ZoomBands.h"
+#include "MultipolygonAssembler.h"
+#include "VectorTileBuilder.h"
+#include "MVTReader.h"
+#include "TilePyramidBuilder.h"
+#include "TileArchive.h"
+#include "TileServer.h"
 #include "vector_tile.pb.h"
 
 using namespace std;
@@ -31,46 +51,11 @@ const int SEG_MOVETO = 1;
 const int SEG_LINETO = 2;
 const int SEG_CLOSE = 7;
 
-typedef int32_t O5MCoord;
-
-struct NodeValue
-{
-	O5MCoord lon;
-	O5MCoord lat;
-	uint64_t fileOffset;
-	uint64_t readerOffset;
-};
-
-
 static int numDBReadNodes = 0;
 static int numDBReadNodesPreviously = 0;
 static high_resolution_clock::time_point readNodeFromDB_T1;
 static double avgNumNodesPerWay = 0.0;
 
-struct BBox
-{
-	O5MCoord minX;
-	O5MCoord minY;
-	O5MCoord maxX;
-	O5MCoord maxY;
-};
-
-class Tag
-{
-public:
-	string key;
-	string value;
-};
-
-class Way
-{
-public:
-	uint64_t id;
-	BBox bbox;
-	TPolygon2D<int32_t> polygon;
-	vector<Tag> tags;
-};
-
 //#pragma optimize( "", off )
 
 MGArchive& operator<<(MGArchive& archive, BBox& bbox)
@@ -131,114 +116,91 @@ MGArchive& operator<<(MGArchive& archive, Way& way)
 }
 
 
-Slice IdToSlice(const uint64_t& id)
-{
-	Slice slice((const char*)&id, sizeof(uint64_t));
-	return slice;
-}
-
-uint64_t SliceToId(const Slice slice)
-{
-	uint64_t* id = (uint64_t*)slice.data();
-	return *id;
-}
-
-class OSMIdComparator : public Comparator {
-public:
-	virtual int Compare(const Slice& a, const Slice& b) const
-	{
-		uint64_t* idA = (uint64_t*)a.data();
-		uint64_t* idB = (uint64_t*)b.data();
-		int64_t delta = (*idA - *idB);
-		if (delta == 0) return 0;
-		return delta < 0 ? -1 : 1;
-	}
-
-	virtual const char* Name() const
-	{
-		return "OSMIdComparator";
-	}
-
-	virtual void FindShortestSeparator( std::string* start, const Slice& limit) const {};
-	virtual void FindShortSuccessor(std::string* key) const {};
-};
-
 // CachedDiskStorageManager vs. DiskStorageManager
 // advantages:
 //  - reduces disk accesses to a minimum
 //  - reduces disk usage by about 40%
 //  - keeping track of index is not memory bound (index is only kept partially in memory)
+//  - thread-safe, concurrent queries only contend if they access pages of the same shard at the same time
 // disadvantages
 //  - leveldb dependency
-class CachedDiskStorageManager : public SpatialIndex::IStorageManager
+//
+// Pages are held in an LRU cache (hash map + intrusive list) bounded by a memory budget in bytes.
+// Least recently used pages are evicted one at a time; dirty pages are not written immediately
+// but collected and written back to leveldb in batches of WriteBackBatchSize bytes.
+// Pages are reference counted and can be pinned (see IPinnedPageStorageManager) to be read without copying.
+// The cache is split into NumShards shards by page id, each one guarded by its own mutex (lock striping).
+class CachedDiskStorageManager : public SpatialIndex::IStorageManager, public IPinnedPageStorageManager
 {
-	const int MaxNumPagesHeldInMemory = 10000;
+	static const uint64_t DefaultCacheSizeInBytes = 256 << 20;
+	static const uint64_t WriteBackBatchSize = 4 << 20;
+	static const int NumShards = 16;
 
 public:
-	CachedDiskStorageManager(const string& filePath)
+	CachedDiskStorageManager(const string& filePath, const uint64_t cacheSizeInBytes = DefaultCacheSizeInBytes)
 		: db(NULL)
 		, isDirty(false)
 		, nextPage(0)
-		, currentUseIndex(0)
 	{
-		options.comparator = new OSMIdComparator();
 		options.create_if_missing = true;
 		options.write_buffer_size = 10 << 20;
 		options.filter_policy = NewBloomFilterPolicy(32);
-		DB::Open(options, filePath, &db);
+		OpenBigEndianKeyedDB(options, filePath, &db);
+
+		for (int s = 0; s < NumShards; s++)
+		{
+			shards[s].db = db;
+			shards[s].cacheSizeInBytes = cacheSizeInBytes / NumShards;
+			shards[s].writeBackBatchSize = WriteBackBatchSize / NumShards;
+		}
 	}
 
 	virtual ~CachedDiskStorageManager() 
 	{
 		flush();
 
-		delete options.comparator;
+		for (int s = 0; s < NumShards; s++)
+		{
+			shards[s].Clear();
+		}
+
 		delete db;
 		delete options.filter_policy;
 	}
 
 	virtual void flush() 
 	{
-		FlushLRUCache(pageIndex.size());
+		for (int s = 0; s < NumShards; s++)
+		{
+			shards[s].Flush();
+		}
 
-		if (isDirty)
+		if (isDirty.exchange(false))
 		{
 			db->CompactRange(NULL, NULL);
-			isDirty = false;
 		}
 	}
 
 	virtual void loadByteArray(const id_type page, uint32_t& len, byte** data) 
 	{
-		*data = NULL;
-		len = 0;
+		shared_ptr<string> pageData = GetShard(page).Load(page);
 
-		std::map<id_type, Entry*>::iterator it = pageIndex.find(page);
-		if (it == pageIndex.end())
+		len = (uint32_t)pageData->size();
+		*data = new byte[len];
+		memcpy(*data, pageData->data(), len);
+	}
+
+	// callers outside of libspatialindex (tile builders, server workers) only handle std::exception
+	virtual PinnedPage loadPinnedPage(const id_type page)
+	{
+		try
 		{
-			ReadOptions ro;
-			string result;
-			if (db->Get(ro, IdToSlice(page), &result).ok())
-			{
-				len = (uint32_t)result.size();
-				*data = new byte[len];
-				memcpy(*data, result.data(), len);
-				AddEntry(page, len, (const byte*)result.data(), false);
-			}
-			else
-			{
-				throw InvalidPageException(page);
-			}
+			return PinnedPage(GetShard(page).Load(page));
 		}
-		else
+		catch (InvalidPageException& e)
 		{
-			it->second->useIndex = currentUseIndex;
-			len = it->second->length;
-			*data = new byte[len];
-			memcpy(*data, it->second->data, len);
+			throw runtime_error(e.what());
 		}
-
-		currentUseIndex++;
 	}
 
 	virtual void storeByteArray(id_type& page, const uint32_t len, const byte* const data) 
@@ -247,130 +209,505 @@ public:
 
 		if (page == StorageManager::NewPage)
 		{
-			page = nextPage;
-			nextPage++;
+			page = nextPage++;
+		}
+
+		GetShard(page).Store(page, len, data);
+	}
+
+	virtual void deleteByteArray(const id_type page)
+	{
+		isDirty = true;
+
+		GetShard(page).Delete(page);
+	}
+
+private:
+
+	class Entry
+	{
+	public:
+		id_type page;
+		shared_ptr<string> data;
+		bool isDirty;
+		bool isPendingWriteBack;
+
+		Entry* prev;
+		Entry* next;
+	};
+
+	// intrusive doubly linked list, front is most recently used
+	class EntryList
+	{
+	public:
+		EntryList()
+			: head(NULL)
+			, tail(NULL)
+		{
+		}
+
+		Entry* Front() const { return head; }
+		Entry* Back() const { return tail; }
+		Entry* Next(const Entry* e) const { return e->next; }
 
-			AddEntry(page, len, data, true);
+		void PushFront(Entry* e)
+		{
+			e->prev = NULL;
+			e->next = head;
+			if (head) head->prev = e;
+			else tail = e;
+			head = e;
 		}
-		else
+
+		void Remove(Entry* e)
 		{
-			std::map<id_type, Entry*>::iterator it = pageIndex.find(page);
-			if (it == pageIndex.end())
+			if (e->prev) e->prev->next = e->next;
+			else head = e->next;
+			if (e->next) e->next->prev = e->prev;
+			else tail = e->prev;
+			e->prev = NULL;
+			e->next = NULL;
+		}
+
+		void MoveToFront(Entry* e)
+		{
+			if (e == head) return;
+			Remove(e);
+			PushFront(e);
+		}
+
+	private:
+		Entry* head;
+		Entry* tail;
+	};
+
+	class Shard
+	{
+	public:
+		DB* db;
+		uint64_t cacheSizeInBytes;
+		uint64_t writeBackBatchSize;
+
+		Shard()
+			: db(NULL)
+			, cacheSizeInBytes(0)
+			, writeBackBatchSize(0)
+			, numBytesCached(0)
+			, numBytesPendingWriteBack(0)
+			, hasPendingWrites(false)
+		{
+		}
+
+		shared_ptr<string> Load(const id_type& page)
+		{
+			{
+				lock_guard<mutex> lock(m);
+				Entry* e = FindEntry(page);
+				if (e) return e->data;
+			}
+
+			// read directly into the buffer of the new cache entry, other threads may use the shard meanwhile
+			shared_ptr<string> data = make_shared<string>();
+			ReadOptions ro;
+			if (!db->Get(ro, BigEndianKey(page).ToSlice(), data.get()).ok())
+			{
+				throw InvalidPageException(page);
+			}
+
+			lock_guard<mutex> lock(m);
+			Entry* e = FindEntry(page); // page may have been loaded by another thread in the meantime
+			if (e == NULL)
+			{
+				e = AddEntry(page, data, false);
+			}
+			return e->data;
+		}
+
+		void Store(const id_type& page, const uint32_t len, const byte* const data)
+		{
+			lock_guard<mutex> lock(m);
+
+			Entry* e = FindEntry(page);
+			if (e == NULL)
 			{
-				AddEntry(page, len, data, true);
+				AddEntry(page, make_shared<string>((const char*)data, len), true);
 			}
 			else
 			{
-				if (len > it->second->length)
+				numBytesCached -= e->data->size();
+				if (e->data.use_count() > 1) // page is pinned, leave the pinned version untouched
+				{
+					e->data = make_shared<string>((const char*)data, len);
+				}
+				else
 				{
-					delete[] it->second->data;
-					it->second->data = new byte[len];
+					e->data->assign((const char*)data, len);
 				}
-				it->second->length = len;
-				memcpy(it->second->data, data, len);
-				it->second->useIndex = currentUseIndex;
-				it->second->isDirty = true;
+				numBytesCached += len;
+				e->isDirty = true;
+
+				EvictLRUEntries();
 			}
 		}
 
-		currentUseIndex++;
-	}
-
-	virtual void deleteByteArray(const id_type page)
-	{
-		map<id_type, Entry*>::iterator it = pageIndex.find(page);
-		if (it == pageIndex.end()) throw InvalidPageException(page);
+		void Delete(const id_type& page)
+		{
+			lock_guard<mutex> lock(m);
 
-		delete it->second;
-		pageIndex.erase(it);
+			auto it = pageIndex.find(page);
+			if (it != pageIndex.end()) // evicted pages only need to be deleted from disk
+			{
+				Entry* e = it->second;
+				if (e->isPendingWriteBack)
+				{
+					writeBackList.Remove(e);
+					numBytesPendingWriteBack -= e->data->size();
+				}
+				else
+				{
+					lruList.Remove(e);
+					numBytesCached -= e->data->size();
+				}
+				delete e;
+				pageIndex.erase(it);
+			}
 
-		isDirty = true;
-		writeBatch.Delete(IdToSlice(page));
-	}
+			writeBatch.Delete(BigEndianKey(page).ToSlice());
+			hasPendingWrites = true;
+		}
 
-private:
+		void Flush()
+		{
+			lock_guard<mutex> lock(m);
 
-	void AddEntry(const id_type& page, const uint32_t len, const byte* const data, bool isDirty)
-	{
-		Entry* e = new Entry();
-		e->length = len;
-		e->data = new byte[len];
-		e->useIndex = currentUseIndex;
-		e->isDirty = isDirty;
-		memcpy(e->data, data, len);
-		pageIndex.insert(std::pair<id_type, Entry*>(page, e));
+			for (Entry* e = lruList.Front(); e != NULL; e = lruList.Next(e))
+			{
+				if (e->isDirty)
+				{
+					writeBatch.Put(BigEndianKey(e->page).ToSlice(), *e->data);
+					e->isDirty = false;
+					hasPendingWrites = true;
+				}
+			}
+			WriteBack();
+		}
 
-		if (pageIndex.size() > MaxNumPagesHeldInMemory)
+		void Clear()
 		{
-			FlushLRUCache(pageIndex.size() / 2);
+			lock_guard<mutex> lock(m);
+
+			for (auto it = pageIndex.begin(); it != pageIndex.end(); ++it)
+			{
+				delete it->second;
+			}
+			pageIndex.clear();
+			lruList = EntryList();
+			writeBackList = EntryList();
+			numBytesCached = 0;
+			numBytesPendingWriteBack = 0;
 		}
-	}
 
-	void FlushLRUCache(const size_t numEntriesToFlush)
-	{
-		if(pageIndex.size() > 0)
+	private:
+		Entry* FindEntry(const id_type& page)
 		{
-			vector<uint64_t> useIndices;
-			useIndices.reserve(pageIndex.size());
-			for (auto it = pageIndex.begin(); it != pageIndex.end(); ++it)
+			auto it = pageIndex.find(page);
+			if (it == pageIndex.end()) return NULL;
+
+			Entry* e = it->second;
+			if (e->isPendingWriteBack) // page was requested again before it hit the disk
 			{
-				useIndices.push_back(it->second->useIndex);
+				writeBackList.Remove(e);
+				numBytesPendingWriteBack -= e->data->size();
+				e->isPendingWriteBack = false;
+				lruList.PushFront(e);
+				numBytesCached += e->data->size();
 			}
-			sort(useIndices.begin(), useIndices.end());
+			else
+			{
+				lruList.MoveToFront(e);
+			}
+			return e;
+		}
 
-			uint64_t limitUseIndex = useIndices[numEntriesToFlush - 1];
+		Entry* AddEntry(const id_type& page, const shared_ptr<string>& data, bool isDirty)
+		{
+			Entry* e = new Entry();
+			e->page = page;
+			e->data = data;
+			e->isDirty = isDirty;
+			e->isPendingWriteBack = false;
+			pageIndex[page] = e;
+
+			lruList.PushFront(e);
+			numBytesCached += data->size();
+
+			EvictLRUEntries();
+			return e;
+		}
 
-			for (auto it = pageIndex.begin(); it != pageIndex.end();)
+		void EvictLRUEntries()
+		{
+			while (numBytesCached > cacheSizeInBytes && lruList.Back() != lruList.Front())
 			{
-				if (it->second->useIndex <= limitUseIndex)
+				Entry* e = lruList.Back();
+				lruList.Remove(e);
+				numBytesCached -= e->data->size();
+
+				if (e->isDirty)
 				{
-					if (it->second->isDirty)
-					{
-						writeBatch.Put(IdToSlice(it->first), Slice((const char*)it->second->data, it->second->length));
-					}
-					delete it->second;
-					it = pageIndex.erase(it);
+					e->isPendingWriteBack = true;
+					writeBackList.PushFront(e);
+					numBytesPendingWriteBack += e->data->size();
 				}
 				else
 				{
-					it++;
+					pageIndex.erase(e->page);
+					delete e;
 				}
 			}
+
+			if (numBytesPendingWriteBack > writeBackBatchSize)
+			{
+				WriteBack();
+			}
 		}
 
-		if(isDirty)
+		void WriteBack()
 		{
-			WriteOptions wo;
-			db->Write(wo, &writeBatch);
-			writeBatch.Clear();
+			while (Entry* e = writeBackList.Back())
+			{
+				writeBackList.Remove(e);
+				writeBatch.Put(BigEndianKey(e->page).ToSlice(), *e->data);
+				pageIndex.erase(e->page);
+				delete e;
+				hasPendingWrites = true;
+			}
+			numBytesPendingWriteBack = 0;
+
+			if (hasPendingWrites)
+			{
+				WriteOptions wo;
+				db->Write(wo, &writeBatch);
+				writeBatch.Clear();
+				hasPendingWrites = false;
+			}
 		}
+
+		mutex m;
+		uint64_t numBytesCached;
+		uint64_t numBytesPendingWriteBack;
+		bool hasPendingWrites;
+		WriteBatch writeBatch;
+		unordered_map<id_type, Entry*> pageIndex;
+		EntryList lruList;
+		EntryList writeBackList;
+	};
+
+	Shard& GetShard(const id_type& page)
+	{
+		return shards[(uint64_t)page % NumShards];
 	}
 
-	class Entry
+	DB* db;
+	Options options;
+	atomic<bool> isDirty;
+	atomic<id_type> nextPage;
+	Shard shards[NumShards];
+};
+
+// WayBulkLoadStream vs. per way R* insertion
+// advantages:
+//  - no reinsertions and page splits while reading ways (tree is built bottom-up in one pass)
+//  - nodes packed to BulkLoadFillFactor with less overlap (STR: Sort-Tile-Recursive)
+//  - memory usage is independent of number of ways (entries are buffered in a spill file)
+// disadvantages
+//  - tree is available only after all ways have been read
+// Write errors invalidate the stream (see IsValid()), read errors throw while the tree is bulk loaded.
+class WayBulkLoadStream : public IDataStream
+{
+public:
+	WayBulkLoadStream(const string& spillFilePath)
+		: spillFilePath(spillFilePath)
+		, file(fopen(spillFilePath.c_str(), "w+b"))
+		, isValid(file != NULL)
+		, numEntries(0)
+		, numEntriesRead(0)
 	{
-	public:
-		uint32_t length;
-		byte* data;
-		uint64_t useIndex;
-		bool isDirty;
+		if (file) setvbuf(file, NULL, _IOFBF, 1 << 20);
+	}
 
-		~Entry()
+	virtual ~WayBulkLoadStream()
+	{
+		if (!file) return;
+
+		fclose(file);
+		remove(spillFilePath.c_str());
+	}
+
+	// false if the spill file couldn't be created or written
+	bool IsValid() const { return isValid; }
+
+	void Add(const uint64_t& wayId, const Region& region, const char* data, const uint32_t len)
+	{
+		assert(region.m_dimension == Dimension);
+		if (!isValid) return;
+
+		isValid = fwrite(&wayId, sizeof(uint64_t), 1, file) == 1 &&
+			fwrite(region.m_pLow, sizeof(double), Dimension, file) == Dimension &&
+			fwrite(region.m_pHigh, sizeof(double), Dimension, file) == Dimension &&
+			fwrite(&len, sizeof(uint32_t), 1, file) == 1 &&
+			fwrite(data, 1, len, file) == len;
+
+		numEntries++;
+	}
+
+	virtual IData* getNext()
+	{
+		if (!hasNext()) return NULL;
+
+		uint64_t wayId;
+		double low[Dimension];
+		double high[Dimension];
+		uint32_t len;
+		if (fread(&wayId, sizeof(uint64_t), 1, file) != 1 ||
+			fread(low, sizeof(double), Dimension, file) != Dimension ||
+			fread(high, sizeof(double), Dimension, file) != Dimension ||
+			fread(&len, sizeof(uint32_t), 1, file) != 1)
 		{
-			delete[] data;
+			throw runtime_error("Failed to read bulk load spill file " + spillFilePath);
 		}
-	};
 
-	DB* db;
-	Options options;
-	bool isDirty;
-	WriteBatch writeBatch;
+		payload.resize(Max<size_t>(len, 1));
+		if (fread(payload.data(), 1, len, file) != len)
+		{
+			throw runtime_error("Failed to read bulk load spill file " + spillFilePath);
+		}
+
+		numEntriesRead++;
+
+		Region region(low, high, Dimension);
+		return new Data(len, payload.data(), region, (id_type)wayId); // Data copies the payload
+	}
+
+	virtual bool hasNext()
+	{
+		return numEntriesRead < numEntries;
+	}
+
+	virtual uint32_t size()
+	{
+		return (uint32_t)numEntries;
+	}
+
+	virtual void rewind()
+	{
+		if (!isValid) return;
+
+		isValid = fflush(file) == 0 && fseek(file, 0, SEEK_SET) == 0;
+		numEntriesRead = 0;
+	}
+
+private:
+	static const uint32_t Dimension = 3;
+
+	string spillFilePath;
+	FILE* file;
+	bool isValid;
+	uint64_t numEntries;
+	uint64_t numEntriesRead;
+	vector<byte> payload;
+};
+
+// libspatialindex requires a fill factor below 1, bulk loaded trees are never inserted into afterwards
+const double BulkLoadFillFactor = 0.99;
 
-	id_type nextPage;
-	uint64_t currentUseIndex;
-	std::map<id_type, Entry*> pageIndex;
+// tag keys which can be filtered on without loading way records (order must not change for an existing index)
+const vector<string> DefaultInterestingKeys
+{
+	"highway", "building", "landuse", "natural", "waterway", "railway", "water", "leisure",
+	"amenity", "boundary", "place", "aeroway", "power", "barrier", "man_made", "tourism",
+	"shop", "route", "bridge", "tunnel", "layer", "area", "name", "ref",
+	"admin_level", "surface", "oneway", "service", "wetland", "wood", "sport", "historic"
 };
 
-void ReadWay(O5mreader* reader, DB* db, ISpatialIndex* tree, const uint64_t& wayId)
+// Everything ReadWay() writes to
+class WayIndexContext
+{
+public:
+	ZoomBandSet zoomBands;
+	vector<ISpatialIndex*> trees;						// one per zoom band
+	vector<WayBulkLoadStream*> bulkLoadStreams;			// one per zoom band (if bulk loading)
+	WayStore* wayStore;
+	TagDictionary tagDictionary;
+	TagKeySet interestingKeys;
+	TagFilter wayFilter;								// applies to multipolygon relations as well
+	IdBitmap relationMemberWayIds;						// ways to be stored (not indexed) even if rejected by the filter
+	MultipolygonAssembler* multipolygonAssembler;
+
+	WayIndexContext()
+		: wayStore(NULL)
+		, multipolygonAssembler(NULL)
+	{
+	}
+
+	// trees write their dirty pages back, so the storage manager has to outlive the context
+	~WayIndexContext()
+	{
+		for (auto tree : trees)
+		{
+			delete tree;
+		}
+		for (auto bulkLoadStream : bulkLoadStreams)
+		{
+			delete bulkLoadStream;
+		}
+		delete multipolygonAssembler;
+		delete wayStore;
+	}
+};
+
+void StoreWay(WayIndexContext& index, Way& way)
+{
+	static MGArchive archive; // reuses its buffer for all ways
+	archive.Clear();
+	EncodeWay(archive, way, index.tagDictionary);
+	index.wayStore->Put(way.id, archive.GetData(), (uint32_t)archive.GetSize());
+}
+
+void IndexWay(WayIndexContext& index, const Way& way)
+{
+	const BBox& bb = way.bbox;
+
+	// the R-tree only holds id, box and tag key mask of the way
+	static MGArchive leafArchive;
+	leafArchive.Clear();
+	EncodeLeafData(leafArchive, way, index.interestingKeys);
+
+	const uint64_t leafDataSize = leafArchive.GetSize();
+	const char* leafData = leafArchive.GetData();
+
+	// sizes may exceed int32 (> 214.7 degrees)
+	const int64_t sizeX = (int64_t)bb.maxX - bb.minX;
+	const int64_t sizeY = (int64_t)bb.maxY - bb.minY;
+	const int64_t sizeMin = min(sizeX, sizeY);
+	const int64_t sizeMax = max(sizeX, sizeY);
+
+	double min[3]{ bb.minX * 0.0000001, bb.minY * 0.0000001, sizeMin * 0.0000001 };
+	double max[3]{ bb.maxX * 0.0000001, bb.maxY * 0.0000001, sizeMax * 0.0000001 };
+	Region siBB(min, max, 3);
+
+	const size_t band = index.zoomBands.FindBand(ComputeMinZoom(bb, way.tags));
+	if (!index.bulkLoadStreams.empty())
+	{
+		index.bulkLoadStreams[band]->Add(way.id, siBB, leafData, (uint32_t)leafDataSize);
+	}
+	else
+	{
+		index.trees[band]->insertData((uint32_t)leafDataSize, (const byte*)leafData, siBB, way.id);
+	}
+}
+
+void ReadWay(O5mreader* reader, DB* db, WayIndexContext& index, const uint64_t& wayId)
 {
 	Way way;
 	way.id = wayId;
@@ -405,24 +742,28 @@ void ReadWay(O5mreader* reader, DB* db, ISpatialIndex* tree, const uint64_t& way
 		way.tags.push_back(tag);
 	}
 
+	// unwanted ways never touch the node db, the way store or the R-trees
+	const bool isWanted = index.wayFilter.Matches(way.tags);
+	if (!isWanted && !index.relationMemberWayIds.Contains(wayId)) return;
+
 	way.polygon.SetNumVertices((int)nodeIds.size());
 
 	ReadOptions ro;
 	auto iterator = db->NewIterator(ro);
-	iterator->Seek(IdToSlice(nodeIds[0]));
+	iterator->Seek(BigEndianKey(nodeIds[0]).ToSlice());
 
 	int nodeIndex = 0;
 	while (iterator->Valid())
 	{
 		uint64_t nodeId = nodeIds[nodeIndex];
-		uint64_t iteratorId = SliceToId(iterator->key());
+		uint64_t iteratorId = BigEndianKey::ToId(iterator->key());
 
 		int64_t delta = nodeId - iteratorId;
 		if (delta > 0)
 		{
 			if (delta > 5)
 			{
-				iterator->Seek(IdToSlice(nodeId));
+				iterator->Seek(BigEndianKey(nodeId).ToSlice());
 				continue;
 			}
 			else
@@ -435,7 +776,7 @@ void ReadWay(O5mreader* reader, DB* db, ISpatialIndex* tree, const uint64_t& way
 		{
 			if (delta < 5)
 			{
-				iterator->Seek(IdToSlice(nodeId));
+				iterator->Seek(BigEndianKey(nodeId).ToSlice());
 				continue;
 			}
 			else
@@ -477,36 +818,77 @@ void ReadWay(O5mreader* reader, DB* db, ISpatialIndex* tree, const uint64_t& way
 
 	way.bbox = bb;
 
-	MGArchive archive;
-	archive << way;
+	StoreWay(index, way); // relation members are needed for multipolygon assembly
+	if (isWanted)
+	{
+		IndexWay(index, way);
+	}
 
-	uint64_t waySize = 0;
-	char* serializedWay = archive.ToByteStream(waySize);
+	avgNumNodesPerWay = avgNumNodesPerWay * 0.9 + nodeIds.size() * 0.1;
+}
 
-	O5MCoord sizeX = bb.maxX - bb.minX;
-	O5MCoord sizeY = bb.maxY - bb.minY;
-	O5MCoord sizeMin = min(sizeX, sizeY);
-	O5MCoord sizeMax = max(sizeX, sizeY);
+uint64_t numAssembledRelations = 0;
+uint64_t numBrokenRelations = 0;
 
-	double min[3]{ bb.minX * 0.0000001, bb.minY * 0.0000001, sizeMin * 0.0000001 };
-	double max[3]{ bb.maxX * 0.0000001, bb.maxY * 0.0000001, sizeMax * 0.0000001 };
-	Region siBB(min, max, 3);
-	tree->insertData((uint32_t)waySize, (const byte*)serializedWay, siBB, wayId);
+// assembles multipolygon relations into areas right away, member ways have to be in the way store already
+void ReadRelation(O5mreader* reader, WayIndexContext& index, const uint64_t& relationId)
+{
+	static vector<RelationMember> members;
+	members.clear();
 
-	avgNumNodesPerWay = avgNumNodesPerWay * 0.9 + nodeIds.size() * 0.1;
+	uint64_t refId;
+	uint8_t type;
+	char* role;
+	while (o5mreader_iterateRefs(reader, &refId, &type, &role) == O5MREADER_ITERATE_RET_NEXT)
+	{
+		if (type != O5MREADER_DS_WAY) continue;
+		members.push_back(RelationMember{ refId, strcmp(role, "inner") == 0 });
+	}
 
-	delete[] serializedWay;
+	vector<Tag> tags;
+	char *key, *val;
+	while (o5mreader_iterateTags(reader, &key, &val) == O5MREADER_ITERATE_RET_NEXT)
+	{
+		Tag tag;
+		tag.key = key;
+		tag.value = val;
+		tags.push_back(tag);
+	}
+
+	if (!IsMultipolygonRelation(tags) || !index.wayFilter.Matches(tags)) return;
+
+	static vector<Way> areas;
+	if (!index.multipolygonAssembler->Assemble(relationId, members, tags, areas))
+	{
+		numBrokenRelations++;
+		return;
+	}
+
+	for (auto& area : areas)
+	{
+		StoreWay(index, area);
+		IndexWay(index, area);
+	}
+	numAssembledRelations++;
 }
 
-class GetAllWaysWithKey : public IVisitor
+class GetAllWaysWithKey : public IVisitor, public IPageEntryVisitor
 {
 public:
 	vector<uint64_t> ways;
-	string key;
-
-	GetAllWaysWithKey(const string& key)
-		: key(key)
+	TagKey key;
+	const WayStore& wayStore;
+	const TagDictionary& tagDictionary;
+	TagKeyMaskFilter keyFilter;
+	bool isKeyInterestingKey;
+
+	GetAllWaysWithKey(const string& key, const WayStore& wayStore, const TagDictionary& tagDictionary, const TagKeySet& interestingKeys)
+		: key(key, tagDictionary)
+		, wayStore(wayStore)
+		, tagDictionary(tagDictionary)
 	{
+		keyFilter = TagKeyMaskFilter{ 0, 0, 0 };
+		isKeyInterestingKey = interestingKeys.GetKeyMask(key, keyFilter.allOf);
 	}
 
 	virtual void visitNode(const INode& in) 
@@ -523,49 +905,170 @@ public:
 			byte* data;
 			in.getData(dataLen, &data);
 
-			MGArchive archive((const char*)data, dataLen);
-			Way way;
-			archive << way;
+			VisitWay(id, data, dataLen);
+
+			delete[] data;
+		}
+	}
+	virtual void visitEntry(const PageEntry& entry)
+	{
+		VisitWay(entry.id, entry.data, entry.length);
+	}
+	virtual void visitEntries(const PageEntry* entries, const uint32_t numEntries)
+	{
+		if (!isKeyInterestingKey)
+		{
+			IPageEntryVisitor::visitEntries(entries, numEntries);
+			return;
+		}
 
-			for (size_t i = 0; i < way.tags.size(); i++)
+		// whole leaf is decided on the tag key masks alone
+		for (uint32_t e = 0; e < numEntries; e++)
+		{
+			const uint64_t keyMask = DecodeLeafTagKeyMask((const char*)entries[e].data, entries[e].length);
+			if (keyFilter.Matches(keyMask))
 			{
-				if (way.tags[i].key == key)
-				{
-					ways.push_back(id);
-					break;
-				}
+				ways.push_back(entries[e].id);
 			}
-
-			delete data;
 		}
 	}
 	virtual void visitData(std::vector<const IData*>& v) 
 	{
-		cout << "Error: visitData (multi data) not implemented" << endl;
+		for (const IData* data : v)
+		{
+			visitData(*data);
+		}
+	}
+
+private:
+	void VisitWay(const uint64_t id, const byte* data, const uint32_t dataLen)
+	{
+		const uint64_t keyMask = DecodeLeafTagKeyMask((const char*)data, dataLen);
+		if (isKeyInterestingKey)
+		{
+			if (keyFilter.Matches(keyMask))
+			{
+				ways.push_back(id);
+			}
+			return;
+		}
+
+		// tags are checked directly on the record, geometry is not decoded at all
+		if (!wayStore.Get(id, record)) return;
+
+		WayRecordView way(record.data(), (uint32_t)record.size(), tagDictionary);
+		if (way.HasKey(key))
+		{
+			ways.push_back(id);
+		}
 	}
+
+	string record; // reused for all candidates
 };
 
-void TestSpatialIndexSpeed(string& wayDBFilePath)
+void TestSpatialIndexSpeed(string& wayDBFilePath, string& wayStoreFilePath)
 {
-	IStorageManager* diskfile = new CachedDiskStorageManager(wayDBFilePath);
-	ISpatialIndex* tree = loadRTree(*diskfile, 1);
+	TagDictionary tagDictionary;
+	if (!tagDictionary.Load(wayDBFilePath + ".tags"))
+	{
+		cerr << "Missing tag dictionary " << wayDBFilePath << ".tags" << endl;
+		return;
+	}
+
+	WayStore wayStore(wayStoreFilePath);
+	if (!wayStore.IsOpen())
+	{
+		cerr << "Failed to open way store " << wayStoreFilePath << endl;
+		return;
+	}
+
+	CachedDiskStorageManager* diskfile = new CachedDiskStorageManager(wayDBFilePath);
+	vector<ISpatialIndex*> trees;
+	TagKeySet interestingKeys;
+	interestingKeys.Load(wayDBFilePath + ".keys");
+	ZoomBandSet zoomBands;
+	zoomBands.Load(wayDBFilePath + ".lod");
+
+	// a 1 degree query roughly covers a z8 tile, bands of higher zoom levels don't have to be traversed
+	const int QueryZoom = 8;
+	const size_t NumVisibleBands = zoomBands.GetNumBandsVisibleAt(QueryZoom);
+
+	const bool UsePinnedPages = true; // traverse pinned pages instead of loading nodes through libspatialindex
+	vector<PinnedRTreeQuery> pinnedQueries;
+	for (size_t b = 0; b < NumVisibleBands; b++)
+	{
+		if (UsePinnedPages)
+		{
+			pinnedQueries.push_back(PinnedRTreeQuery(*diskfile, zoomBands.bands[b].indexId));
+		}
+		else
+		{
+			trees.push_back(loadRTree(*diskfile, zoomBands.bands[b].indexId));
+		}
+	}
 
 	high_resolution_clock::time_point t1 = high_resolution_clock::now();
 
-	GetAllWaysWithKey getAllWays("highway");
+	GetAllWaysWithKey getAllWays("highway", wayStore, tagDictionary, interestingKeys);
 
 	double min[3]{ 4.0, 52.0, 0.004 };
 	double max[3]{ 5.0, 53.0, 500.0 };
 	//double min[3]{ -180.0, -90.0, 0.0 };
 	//double max[3]{ 180.0, 90.0, 500.0 };
 	Region queryAABB(min, max, 3);
-	tree->intersectsWithQuery(queryAABB, getAllWays);
+	for (auto& pinnedQuery : pinnedQueries)
+	{
+		pinnedQuery.intersectsWithQuery(queryAABB, getAllWays);
+	}
+	for (auto tree : trees)
+	{
+		tree->intersectsWithQuery(queryAABB, getAllWays);
+	}
 
 	cout << "Num Ways returned: " << getAllWays.ways.size() << "                               " << endl;
 	high_resolution_clock::time_point t2 = high_resolution_clock::now();
 	duration<double> time_span = duration_cast<duration<double>>(t2 - t1);
 
-	cout << "Num Query took seconds: " << time_span.count() << "                               " << endl;
+	cout << "Num Query took seconds: " << time_span.count() << "                               " << endl;
+
+	// the storage manager is shared by all threads, each thread needs its own query (holds traversal state)
+	const int NumQueryThreads = 8;
+	const int NumQueriesPerThread = 10;
+	vector<thread> queryThreads;
+	t1 = high_resolution_clock::now();
+	for (int t = 0; t < NumQueryThreads; t++)
+	{
+		queryThreads.push_back(thread([&]()
+		{
+			vector<PinnedRTreeQuery> queries;
+			for (size_t b = 0; b < NumVisibleBands; b++)
+			{
+				queries.push_back(PinnedRTreeQuery(*diskfile, zoomBands.bands[b].indexId));
+			}
+			for (int q = 0; q < NumQueriesPerThread; q++)
+			{
+				GetAllWaysWithKey getAllWaysConcurrently("highway", wayStore, tagDictionary, interestingKeys);
+				for (auto& query : queries)
+				{
+					query.intersectsWithQuery(queryAABB, getAllWaysConcurrently);
+				}
+			}
+		}));
+	}
+	for (auto& queryThread : queryThreads)
+	{
+		queryThread.join();
+	}
+	t2 = high_resolution_clock::now();
+	time_span = duration_cast<duration<double>>(t2 - t1);
+
+	cout << "Concurrent queries/s (" << NumQueryThreads << " threads): " << (NumQueryThreads * NumQueriesPerThread) / time_span.count() << "                               " << endl;
+
+	for (auto tree : trees)
+	{
+		delete tree;
+	}
+	delete diskfile;
 }
 
 class Polygon
@@ -575,32 +1078,18 @@ public:
 	TPolygon2D<double>* polygons;
 	int numPolygons;
 
-	Polygon(const uint64_t id, const double scale, const TPolygon2D<int32_t>& exterior, 
-			const TPolygon2D<int32_t>* interior = NULL, 
-			const uint32_t numInteriors = 0)
+	// takes over closed rings, the exterior (ComputeArea() <= 0) followed by its holes (ComputeArea() >= 0)
+	Polygon(const uint64_t id, TPolygon2D<double>* rings, const int numRings)
 		: id(id)
-		, polygons(new TPolygon2D<double>[1 + numInteriors])
-		, numPolygons(1 + numInteriors)
+		, polygons(new TPolygon2D<double>[numRings])
+		, numPolygons(numRings)
 	{
-		// copy outer perimeter
-		{
-			polygons[0] = exterior.Clone<double>(scale);
-			polygons[0].CloseRing();
-
-			double area = polygons[0].ComputeArea();
-			assert(area <= 0.0);
-		}
-
-		// create inner holes
+		for (int p = 0; p < numRings; p++)
 		{
-			for (uint32_t p = 0; p < numInteriors; p++)
-			{
-				polygons[p + 1] = interior[p].Clone<double>(scale);
-				polygons[p + 1].CloseRing();
+			polygons[p] = move(rings[p]);
 
-				double area = polygons[p + 1].ComputeArea();
-				assert(area >= 0.0);
-			}
+			double area = polygons[p].ComputeArea();
+			assert(p == 0 ? area <= 0.0 : area >= 0.0);
 		}
 	}
 
@@ -647,26 +1136,42 @@ public:
 	}
 };
 
-int32_t ZigZagUint32ToInt32(uint32_t zigzag)
+TPolygon2D<double> CreateScaledPolygon(const MVTGeometryBuffers& geometry, const uint32_t part, const double scale)
 {
-	return (int32_t)((zigzag & 1) ? -(int64_t)(zigzag >> 1) - 1 : (int64_t)(zigzag >> 1));
+	const uint32_t begin = geometry.GetPartBegin(part);
+	const uint32_t numVertices = geometry.GetPartEnd(part) - begin;
+
+	TPolygon2D<double> polygon;
+	polygon.SetNumVertices((int)numVertices);
+	TVector2D<double>* vertices = polygon.GetVertices();
+	for (uint32_t v = 0; v < numVertices; v++)
+	{
+		vertices[v] = TVector2D<double>(geometry.x[begin + v] * scale, geometry.y[begin + v] * scale);
+	}
+	return polygon;
 }
 
-void OutputTile(bool verbose, vector_tile::Tile& tile)
+void OutputTile(bool verbose, const char* data, const size_t size)
 {
+	MVTReader reader(data, size);
+	MVTLayer layer;
+	MVTFeature feature;
+
 	if (!verbose) {
-		std::cout << "layers: " << static_cast<std::size_t>(tile.layers_size()) << "\n";
-		for (std::size_t i = 0; i<static_cast<std::size_t>(tile.layers_size()); ++i)
+		std::cout << "layers: " << reader.GetNumLayers() << "\n";
+
+		MVTGeometryBuffers geometry; // reused for all features
+		vector<TPolygon2D<double>> rings;
+		while (reader.NextLayer(layer))
 		{
-			vector_tile::Tile_Layer const& layer = tile.layers(i);
-			const double tileScale = 1.0 / layer.extent();
-
-			std::cout << layer.name() << ":\n";
-			std::cout << "  version: " << layer.version() << "\n";
-			std::cout << "  extent: " << layer.extent() << "\n";
-			std::cout << "  features: " << static_cast<std::size_t>(layer.features_size()) << "\n";
-			std::cout << "  keys: " << static_cast<std::size_t>(layer.keys_size()) << "\n";
-			std::cout << "  values: " << static_cast<std::size_t>(layer.values_size()) << "\n";
+			const double tileScale = 1.0 / layer.extent;
+
+			std::cout << layer.GetName() << ":\n";
+			std::cout << "  version: " << layer.version << "\n";
+			std::cout << "  extent: " << layer.extent << "\n";
+			std::cout << "  features: " << layer.numFeatures << "\n";
+			std::cout << "  keys: " << layer.numKeys << "\n";
+			std::cout << "  values: " << layer.numValues << "\n";
 			unsigned total_repeated = 0;
 			unsigned num_commands = 0;
 			unsigned num_move_to = 0;
@@ -677,110 +1182,83 @@ void OutputTile(bool verbose, vector_tile::Tile& tile)
 
 			vector<Polygon> polygons;
 			vector<TPolygon2D<double>> lineStrings;
-			uint64_t lastFeatureId = 0;
-			for (std::size_t j = 0; j<static_cast<std::size_t>(layer.features_size()); ++j)
+			while (layer.NextFeature(feature))
 			{
-				int32_t cursorX = 0;
-				int32_t cursorY = 0;
-				vector_tile::Tile_Feature const & f = layer.features(j);
-				total_repeated += f.geometry_size();
-				int cmd = -1;
-				const int cmd_bits = 3;
-				unsigned length = 0;
+				total_repeated += feature.geometry.GetNumValues();
 				unsigned g_length = 0;
-				vector<TPolygon2D<int32_t>> polys;
-				TPolygon2D<int32_t> poly;
-				for (int k = 0; k < f.geometry_size();)
+				geometry.Clear();
+
+				MVTGeometryReader commands(feature.geometry);
+				uint32_t cmd, length;
+				bool hasUnknownCommand = false;
+				while (!hasUnknownCommand && commands.NextCommand(cmd, length))
 				{
-					if (!length) {
-						unsigned cmd_length = f.geometry(k++);
-						cmd = cmd_length & ((1 << cmd_bits) - 1);
-						length = cmd_length >> cmd_bits;
-						if (length <= 0) num_empty++;
-						num_commands++;
-					}
-					if (length > 0) {
-						length--;
-						if (cmd == SEG_MOVETO || cmd == SEG_LINETO)
-						{
-							uint32_t xZigZag = f.geometry(k++);
-							uint32_t yZigZag = f.geometry(k++);
-							int32_t xRel = ZigZagUint32ToInt32(xZigZag);
-							int32_t yRel = ZigZagUint32ToInt32(yZigZag);
-							cursorX += xRel;
-							cursorY += yRel;
+					if (length <= 0) num_empty++;
+					num_commands++;
 
+					if (cmd == SEG_MOVETO || cmd == SEG_LINETO)
+					{
+						int32_t x, y;
+						for (uint32_t v = 0; v < length && commands.NextVertex(x, y); v++)
+						{
 							g_length++;
 							if (cmd == SEG_MOVETO)
 							{
-								if (poly.GetNumVertices() > 0)
-								{
-									polys.push_back(move(poly));
-									poly = TPolygon2D<int32_t>();
-									poly.ReserveNumVertices(10);
-								}
-
+								geometry.BeginPart();
 								num_move_to++;
 							}
-							else if (cmd == SEG_LINETO)
+							else
 							{
 								num_line_to++;
 							}
 
-							poly.AddVertex(TVector2D<int32_t>(cursorX, cursorY));
+							geometry.AddVertex(x, y);
 						}
-						else if (cmd == (SEG_CLOSE & ((1 << cmd_bits) - 1)))
+					}
+					else if (cmd == SEG_CLOSE)
+					{
+						for (uint32_t c = 0; c < length; c++)
 						{
 							if (g_length <= 2) degenerate++;
 							g_length = 0;
 							num_close++;
-
-							polys.push_back(move(poly));
-							poly = TPolygon2D<int32_t>();
-							poly.ReserveNumVertices(10);
-						}
-						else
-						{
-							std::stringstream s;
-							s << "Unknown command type: " << cmd;
-							throw std::runtime_error(s.str());
 						}
 					}
+					else
+					{
+						hasUnknownCommand = true;
+					}
+				}
+				if (hasUnknownCommand || !commands.IsValid())
+				{
+					cerr << "Failed to parse tile." << endl; // unknown command or truncated geometry, the feature is skipped
+					continue;
 				}
 
-				if (f.type() == vector_tile::Tile_GeomType_POLYGON)
+				if (feature.type == vector_tile::Tile_GeomType_POLYGON)
 				{
-					size_t polyStartIndex = 0;
-					for (size_t p = 0; p < polys.size(); p++)
+					rings.clear();
+					uint32_t polyStartIndex = 0;
+					for (uint32_t p = 0; p < geometry.GetNumParts(); p++)
 					{
-						int64_t polyArea = polys[p].ComputeArea<int64_t>();
-						if (p > polyStartIndex && polyArea < 0) // test for multipolygons including interior polys
+						rings.push_back(CreateScaledPolygon(geometry, p, tileScale));
+						rings.back().CloseRing();
+						if (p > polyStartIndex && rings.back().ComputeArea() < 0.0) // test for multipolygons including interior polys
 						{
-							auto& poly = polys[polyStartIndex];
-							const auto* nextPoly = &polys[polyStartIndex + 1];
-							Polygon polygon(f.id(), tileScale, poly,
-								(polyStartIndex + 1 < polys.size() ) ? nextPoly : NULL,
-								(uint32_t)(p - polyStartIndex - 1));
-							polygons.push_back(move(polygon));
-
+							polygons.push_back(Polygon(feature.id, &rings[polyStartIndex], (int)(p - polyStartIndex)));
 							polyStartIndex = p;
 						}
 					}
-					if (polyStartIndex < polys.size())
+					if (polyStartIndex < rings.size())
 					{
-						Polygon polygon(f.id(), tileScale, polys[polyStartIndex],
-							(polyStartIndex + 1 < polys.size()) ? &polys[polyStartIndex + 1] : NULL,
-							(uint32_t)(polys.size() - 1 - polyStartIndex));
-						polygons.push_back(move(polygon));
+						polygons.push_back(Polygon(feature.id, &rings[polyStartIndex], (int)(rings.size() - polyStartIndex)));
 					}
 				}
-				else if (f.type() == vector_tile::Tile_GeomType_LINESTRING)
+				else if (feature.type == vector_tile::Tile_GeomType_LINESTRING)
 				{
-					polys.push_back(move(poly));
-
-					for (const auto& p : polys)
+					for (uint32_t p = 0; p < geometry.GetNumParts(); p++)
 					{
-						lineStrings.push_back(move(p.Clone<double>(tileScale)));
+						lineStrings.push_back(CreateScaledPolygon(geometry, p, tileScale));
 					}
 				}
 			}
@@ -797,61 +1275,47 @@ void OutputTile(bool verbose, vector_tile::Tile& tile)
 		}
 	}
 	else {
-		for (std::size_t j = 0; j < static_cast<std::size_t>(tile.layers_size()); ++j)
+		while (reader.NextLayer(layer))
 		{
-			vector_tile::Tile_Layer const& layer = tile.layers(j);
-			std::cout << "layer: " << layer.name() << "\n";
-			std::cout << "  version: " << layer.version() << "\n";
-			std::cout << "  extent: " << layer.extent() << "\n";
+			std::cout << "layer: " << layer.GetName() << "\n";
+			std::cout << "  version: " << layer.version << "\n";
+			std::cout << "  extent: " << layer.extent << "\n";
 			std::cout << "  keys: ";
-			for (std::size_t k = 0; k < static_cast<std::size_t>(layer.keys_size()); ++k)
+			const char* key;
+			uint32_t keyLength;
+			for (uint32_t k = 0; layer.NextKey(key, keyLength); ++k)
 			{
-				std::string const& key = layer.keys(k);
-				std::cout << key;
-				if (k < static_cast<std::size_t>(layer.keys_size()) - 1) {
+				if (k > 0) {
 					std::cout << ",";
 				}
+				std::cout.write(key, keyLength);
 			}
 			std::cout << "\n";
 			std::cout << "  values: ";
-			for (std::size_t l = 0; l < static_cast<std::size_t>(layer.values_size()); ++l)
+			MVTValue value;
+			for (uint32_t l = 0; layer.NextValue(value); ++l)
 			{
-				vector_tile::Tile_Value const & value = layer.values(l);
-				if (value.has_string_value()) {
-					std::cout << value.string_value();
-				}
-				else if (value.has_int_value()) {
-					std::cout << value.int_value();
-				}
-				else if (value.has_double_value()) {
-					std::cout << value.double_value();
-				}
-				else if (value.has_float_value()) {
-					std::cout << value.float_value();
-				}
-				else if (value.has_bool_value()) {
-					std::cout << value.bool_value();
-				}
-				else if (value.has_sint_value()) {
-					std::cout << value.sint_value();
-				}
-				else if (value.has_uint_value()) {
-					std::cout << value.uint_value();
-				}
-				else {
-					std::cout << "null";
-				}
-				if (l < static_cast<std::size_t>(layer.values_size()) - 1) {
+				if (l > 0) {
 					std::cout << ",";
 				}
+				switch (value.type)
+				{
+				case MVTValue::TypeString: std::cout.write(value.stringValue, value.stringLength); break;
+				case MVTValue::TypeInt: std::cout << value.intValue; break;
+				case MVTValue::TypeDouble: std::cout << value.doubleValue; break;
+				case MVTValue::TypeFloat: std::cout << value.floatValue; break;
+				case MVTValue::TypeBool: std::cout << value.boolValue; break;
+				case MVTValue::TypeSInt: std::cout << value.intValue; break;
+				case MVTValue::TypeUInt: std::cout << value.uintValue; break;
+				default: std::cout << "null"; break;
+				}
 			}
 			std::cout << "\n";
-			for (std::size_t l = 0; l < static_cast<std::size_t>(layer.features_size()); ++l)
+			while (layer.NextFeature(feature))
 			{
-				vector_tile::Tile_Feature const & feat = layer.features(l);
-				std::cout << "  feature: " << feat.id() << "\n";
+				std::cout << "  feature: " << feature.id << "\n";
 				std::cout << "    type: ";
-				unsigned feat_type = feat.type();
+				unsigned feat_type = feature.type;
 				if (feat_type == 0) {
 					std::cout << "Unknown";
 				}
@@ -866,73 +1330,342 @@ void OutputTile(bool verbose, vector_tile::Tile& tile)
 				}
 				std::cout << "\n";
 				std::cout << "    tags: ";
-				for (std::size_t m = 0; m < static_cast<std::size_t>(feat.tags_size()); ++m)
+				MVTPackedUint32 tags = feature.tags;
+				uint32_t tag;
+				for (uint32_t m = 0; tags.Next(tag); ++m)
 				{
-					uint32_t tag = feat.tags(j);
-					std::cout << tag;
-					if (m < static_cast<std::size_t>(feat.tags_size()) - 1) {
+					if (m > 0) {
 						std::cout << ",";
 					}
+					std::cout << tag;
 				}
 				std::cout << "\n";
 				std::cout << "    geometries: ";
-				for (std::size_t m = 0; m < static_cast<std::size_t>(feat.geometry_size()); ++m)
+				MVTPackedUint32 geometry = feature.geometry;
+				uint32_t geom;
+				for (uint32_t m = 0; geometry.Next(geom); ++m)
 				{
-					uint32_t geom = feat.geometry(m);
-					std::cout << geom;
-					if (m < static_cast<std::size_t>(feat.geometry_size()) - 1) {
+					if (m > 0) {
 						std::cout << ",";
 					}
+					std::cout << geom;
 				}
 				std::cout << "\n";
 			}
 			std::cout << "\n";
 		}
 	}
+
+	if (!reader.IsValid() || !layer.IsValid())
+	{
+		cerr << "Failed to parse tile." << endl;
+	}
 }
 
 void ReadVectorTileFromPBF()
 {
-	GOOGLE_PROTOBUF_VERIFY_VERSION;
+	FILE* f = fopen("../test/files/0-0-0.pbf", "rb");
+	if (!f)
+	{
+		cerr << "Failed to open tile." << endl;
+		return;
+	}
+
+	fseek(f, 0, SEEK_END);
+	vector<char> data(ftell(f));
+	fseek(f, 0, SEEK_SET);
+	data.resize(fread(data.data(), 1, data.size(), f));
+	fclose(f);
+
+	OutputTile(false, data.data(), data.size());
+}
+
+void BuildVectorTile(const string& wayDBFilePath, const string& wayStoreFilePath, const string& tileFilePath, const int zoom, const int tileX, const int tileY)
+{
+	CachedDiskStorageManager diskfile(wayDBFilePath);
+	WayStore wayStore(wayStoreFilePath);
+	if (!wayStore.IsOpen())
+	{
+		cerr << "Failed to open way store " << wayStoreFilePath << endl;
+		return;
+	}
+	TagDictionary tagDictionary;
+	if (!tagDictionary.Load(wayDBFilePath + ".tags"))
+	{
+		cerr << "Missing tag dictionary " << wayDBFilePath << ".tags" << endl;
+		return;
+	}
+	ZoomBandSet zoomBands;
+	zoomBands.Load(wayDBFilePath + ".lod");
+	const vector<TileLayerDefinition> layerDefinitions = CreateDefaultTileLayerDefinitions();
 
+	VectorTileBuilder builder(diskfile, zoomBands, wayStore, tagDictionary, layerDefinitions);
 	vector_tile::Tile tile;
 
+	high_resolution_clock::time_point t1 = high_resolution_clock::now();
+	builder.BuildTile(zoom, tileX, tileY, tile);
+	string data;
+	tile.SerializeToString(&data);
+	duration<double> time_span = duration_cast<duration<double>>(high_resolution_clock::now() - t1);
+
+	cout << "Tile " << zoom << "/" << tileX << "/" << tileY << ": " << data.size() << " bytes, took seconds: " << time_span.count() << endl;
+
+	MVTWriter writer;
+	t1 = high_resolution_clock::now();
+	builder.BuildTile(zoom, tileX, tileY, writer);
+	time_span = duration_cast<duration<double>>(high_resolution_clock::now() - t1);
+
+	const bool writerMatches = writer.GetSize() == data.size() && memcmp(writer.GetData(), data.data(), data.size()) == 0;
+	cout << "MVTWriter took seconds: " << time_span.count() << (writerMatches ? " (identical to protobuf)" : " (MISMATCH)") << endl;
+
+	FILE* f = fopen(tileFilePath.c_str(), "wb");
+	if (!f)
+	{
+		cerr << "Failed to create tile file " << tileFilePath << endl;
+		return;
+	}
+	const bool written = fwrite(data.data(), 1, data.size(), f) == data.size();
+	if (fclose(f) != 0 || !written)
+	{
+		cerr << "Failed to write tile file " << tileFilePath << endl;
+	}
+
+	OutputTile(false, data.data(), data.size());
+}
+
+class TileArchiveSink : public ITileSink
+{
+public:
+	TileArchiveSink(TileArchiveWriter& archive)
+		: archive(archive)
+	{
+	}
+
+	virtual void AddTile(const TileCoord& tile, const char* data, const size_t size)
+	{
+		archive.AddTile(tile, data, size);
+	}
+
+private:
+	TileArchiveWriter& archive;
+};
+
+void BuildTilePyramid(const string& wayDBFilePath, const string& wayStoreFilePath, const string& archiveFilePath, const double* low, const double* high, const int minZoom, const int maxZoom,
+	const TileArchiveCompression compression)
+{
+	CachedDiskStorageManager diskfile(wayDBFilePath);
+	WayStore wayStore(wayStoreFilePath);
+	if (!wayStore.IsOpen())
+	{
+		cerr << "Failed to open way store " << wayStoreFilePath << endl;
+		return;
+	}
+	TagDictionary tagDictionary;
+	if (!tagDictionary.Load(wayDBFilePath + ".tags"))
+	{
+		cerr << "Missing tag dictionary " << wayDBFilePath << ".tags" << endl;
+		return;
+	}
+	ZoomBandSet zoomBands;
+	zoomBands.Load(wayDBFilePath + ".lod");
+	const vector<TileLayerDefinition> layerDefinitions = CreateDefaultTileLayerDefinitions();
+
+	TileArchiveWriter archive(archiveFilePath, compression);
+	if (!archive.IsOpen())
+	{
+		cerr << "Failed to create tile archive " << archiveFilePath << endl;
+		return;
+	}
+	TileArchiveSink sink(archive);
+
+	// storage manager and way store are shared, each worker has its own tile builder
+	TilePyramidBuilder pyramidBuilder(diskfile, zoomBands, wayStore, tagDictionary, layerDefinitions, (int)thread::hardware_concurrency());
+	if (!pyramidBuilder.Build(low, high, minZoom, maxZoom, sink))
+	{
+		cerr << "Invalid zoom range " << minZoom << "-" << maxZoom << endl;
+		return;
+	}
+	pyramidBuilder.PrintStatistics();
+
+	if (!archive.Finish())
+	{
+		cerr << "Failed to write tile archive " << archiveFilePath << endl;
+		return;
+	}
+
+	TileArchiveReader archiveReader;
+	if (archiveReader.Open(archiveFilePath))
+	{
+		cout << "Tile archive: " << archive.GetNumTiles() << " tiles, " << archive.GetNumUniqueTiles() << " unique, "
+			<< archiveReader.GetNumEntries() << " directory entries" << endl;
+	}
+}
+
+// changes whenever the index is rebuilt (the .lod file is written last), so tiles of an older index are not served from the cache
+uint64_t GetIndexVersion(const string& wayDBFilePath)
+{
+	struct stat status;
+	return stat((wayDBFilePath + ".lod").c_str(), &status) == 0 ? (uint64_t)status.st_mtime : 0;
+}
+
+// serves tiles of the archive (if there is one) and builds all others on demand, until the process is killed
+int RunTileServer(const string& wayDBFilePath, const string& wayStoreFilePath, const string& archiveFilePath)
+{
+	CachedDiskStorageManager diskfile(wayDBFilePath);
+	WayStore wayStore(wayStoreFilePath);
+	if (!wayStore.IsOpen())
+	{
+		cerr << "Failed to open way store " << wayStoreFilePath << endl;
+		return 1;
+	}
+	TagDictionary tagDictionary;
+	if (!tagDictionary.Load(wayDBFilePath + ".tags"))
+	{
+		cerr << "Missing tag dictionary " << wayDBFilePath << ".tags" << endl;
+		return 1;
+	}
+	ZoomBandSet zoomBands;
+	zoomBands.Load(wayDBFilePath + ".lod");
+	const vector<TileLayerDefinition> layerDefinitions = CreateDefaultTileLayerDefinitions();
+
+	TileServer server((int)thread::hardware_concurrency());
+	TileArchiveReader archive;
+	if (archive.Open(archiveFilePath))
+	{
+		cout << "Tile archive: " << archiveFilePath << " (" << archive.GetNumEntries() << " directory entries)" << endl;
+		server.SetArchive(&archive);
+	}
+	server.SetOnDemandGeneration(diskfile, zoomBands, wayStore, tagDictionary, layerDefinitions, GetIndexVersion(wayDBFilePath));
+
+	const int Port = 8080;
+	cout << "Serving http://localhost:" << Port << "/z/x/y.mvt and /stats" << endl;
+	if (!server.Run(Port))
+	{
+		cerr << "Failed to listen on port " << Port << endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Pre-pass over the relations (nodes and ways are jumped over) which marks the member ways of multipolygon relations
+// passing the filter, so those ways are stored for assembly even if they are rejected by the filter themselves.
+void CollectRelationMemberWayIds(const string& srcFilePath, const TagFilter& wayFilter, IdBitmap& memberWayIds)
+{
+	FILE* f = fopen(srcFilePath.c_str(), "rb");
+	O5mreader* reader;
+	o5mreader_open(&reader, f);
+
+	vector<uint64_t> wayIds;
+	vector<Tag> tags;
+	O5mreaderDataset ds;
+	uint8_t skipType = O5MREADER_DS_NODE;
+	while (o5mreader_iterateDataSetSkipping(reader, &ds, skipType) == O5MREADER_ITERATE_RET_NEXT)
+	{
+		if (ds.type == O5MREADER_DS_WAY)
+		{
+			skipType = O5MREADER_DS_WAY; // node section is over (the first way is decoded anyway)
+			continue;
+		}
+		if (ds.type != O5MREADER_DS_REL) continue;
+
+		wayIds.clear();
+		uint64_t refId;
+		uint8_t type;
+		char* role;
+		while (o5mreader_iterateRefs(reader, &refId, &type, &role) == O5MREADER_ITERATE_RET_NEXT)
+		{
+			if (type == O5MREADER_DS_WAY) wayIds.push_back(refId);
+		}
+
+		tags.clear();
+		char *key, *val;
+		while (o5mreader_iterateTags(reader, &key, &val) == O5MREADER_ITERATE_RET_NEXT)
+		{
+			Tag tag;
+			tag.key = key;
+			tag.value = val;
+			tags.push_back(tag);
+		}
+
+		if (!IsMultipolygonRelation(tags) || !wayFilter.Matches(tags)) continue;
+
+		for (auto id : wayIds)
+		{
+			memberWayIds.Add(id);
+		}
+	}
+
+	o5mreader_close(reader);
+	fclose(f);
+
+	cout << "Multipolygon member ways: " << memberWayIds.GetNumIds() << "                               " << endl;
+}
+
+// Pre-pass over the ways (node data sets are jumped over without being decoded) which marks
+// all nodes referenced by ways passing the filter (or by multipolygon members), so the node pass only has to store those.
+void CollectReferencedNodeIds(const string& srcFilePath, const TagFilter& wayFilter, const IdBitmap& relationMemberWayIds, IdBitmap& referencedNodeIds)
+{
+	FILE* f = fopen(srcFilePath.c_str(), "rb");
+	O5mreader* reader;
+	o5mreader_open(&reader, f);
+
+	high_resolution_clock::time_point t1 = high_resolution_clock::now();
+
+	vector<uint64_t> nodeIds;
+	vector<Tag> tags;
+	O5mreaderDataset ds;
+	while (o5mreader_iterateDataSetSkipping(reader, &ds, O5MREADER_DS_NODE) == O5MREADER_ITERATE_RET_NEXT)
 	{
-		fstream input("../test/files/0-0-0.pbf", ios::in | ios::binary);
-		input.seekg(0, input.end);
-		uint64_t size = input.tellg();
-		input.seekg(0, input.beg);
-		char* buffer = new char[size];
-		input.read(buffer, size);
+		if (ds.type == O5MREADER_DS_REL) break; // relations follow the ways, nothing left to collect
+		if (ds.type != O5MREADER_DS_WAY) continue;
 
-		if (!tile.ParseFromArray(buffer, (int)size)) 
+		nodeIds.clear();
+		uint64_t nodeId;
+		while (o5mreader_iterateNds(reader, &nodeId) == O5MREADER_ITERATE_RET_NEXT)
 		{
-			cerr << "Failed to parse tile." << endl;
-			return;
+			nodeIds.push_back(nodeId);
 		}
 
-		OutputTile(false, tile);
+		tags.clear();
+		char *key, *val;
+		while (o5mreader_iterateTags(reader, &key, &val) == O5MREADER_ITERATE_RET_NEXT)
+		{
+			Tag tag;
+			tag.key = key;
+			tag.value = val;
+			tags.push_back(tag);
+		}
 
-		delete buffer;
+		if (!wayFilter.Matches(tags) && !relationMemberWayIds.Contains(ds.id)) continue;
+
+		for (auto id : nodeIds)
+		{
+			referencedNodeIds.Add(id);
+		}
 	}
 
+	o5mreader_close(reader);
+	fclose(f);
 
-	google::protobuf::ShutdownProtobufLibrary();
+	duration<double> time_span = duration_cast<duration<double>>(high_resolution_clock::now() - t1);
+	cout << "Referenced nodes: " << referencedNodeIds.GetNumIds() << " (" << (referencedNodeIds.GetSizeInBytes() >> 20) << " MB bitmap, "
+		<< time_span.count() << " seconds)                               " << endl;
 }
 
 #pragma optimize( "", on )
 int main() 
 {
+	GOOGLE_PROTOBUF_VERIFY_VERSION;
+	atexit(google::protobuf::ShutdownProtobufLibrary);
+
+#ifndef O5M_TILE_SERVER
 	ReadVectorTileFromPBF();
 	return 0;
+#endif
 
 	O5mreader* reader;
 	O5mreaderDataset ds;
-	O5mreaderIterateRet ret, ret2;
-	char *key, *val;
-	uint64_t refId;
-	uint8_t type;
-	char *role;
+	O5mreaderIterateRet ret;
 
 	string baseFile = "netherlands.osm.o5m";
 	//string baseFile = "antarctica-2016-01-06.osm.o5m";
@@ -940,28 +1673,126 @@ int main()
 	string root = "../test/files/";
 	string nodeDBFilePath = root + baseFile + ".nd-idx";
 	string wayDBFilePath = root + baseFile + ".way";
+	string wayStoreFilePath = root + baseFile + ".ways";
+
+#ifdef O5M_TILE_SERVER
+	return RunTileServer(wayDBFilePath, wayStoreFilePath, root + baseFile + ".mvta");
+#endif
 
 	const bool PerformSpeedTest = false;
 	if(PerformSpeedTest)
 	{
-		TestSpatialIndexSpeed(wayDBFilePath);
+		TestSpatialIndexSpeed(wayDBFilePath, wayStoreFilePath);
+		return 0;
+	}
+
+	const bool PerformTileBuildTest = false;
+	if (PerformTileBuildTest)
+	{
+		BuildVectorTile(wayDBFilePath, wayStoreFilePath, root + "8-131-84.pbf", 8, 131, 84); // Amsterdam
+		return 0;
+	}
+
+	const bool PerformPyramidBuild = false;
+	if (PerformPyramidBuild)
+	{
+		const double low[2]{ 3.3, 50.7 }; // Netherlands
+		const double high[2]{ 7.3, 53.6 };
+		// the archive feeds the tile server (RunTileServer()), which sends uncompressed tiles zero-copy (sendfile),
+		// a Snappy archive is smaller, but every tile would be decompressed per request
+		BuildTilePyramid(wayDBFilePath, wayStoreFilePath, root + baseFile + ".mvta", low, high, 0, 14, TileArchiveCompressionNone);
 		return 0;
 	}
 
-	SpatialIndex::id_type indexId = 0;
-	IStorageManager* diskfile = new CachedDiskStorageManager(wayDBFilePath);
-	ISpatialIndex* tree = createNewRTree(*diskfile, 0.7, 100, 100, 3, RV_RSTAR, indexId);
+	// declared before the context, which is cleaned up first on every return
+	unique_ptr<IStorageManager> diskfile(new CachedDiskStorageManager(wayDBFilePath));
+	WayIndexContext index;
+	const bool wayStoreExists = experimental::filesystem::exists(wayStoreFilePath);
+	index.wayStore = new WayStore(wayStoreFilePath);
+	if (!index.wayStore->IsOpen())
+	{
+		cerr << "Failed to open way store " << wayStoreFilePath << endl;
+		return 1;
+	}
+	index.multipolygonAssembler = new MultipolygonAssembler(*index.wayStore, index.tagDictionary);
+	// see TagFilter, e.g. "highway" for a roads only index or "building,!disused" for buildings only
+	const string WayFilterExpression = "";
+	bool wayFilterFileExists;
+	if (!index.wayFilter.Load(wayDBFilePath + ".filter", wayFilterFileExists))
+	{
+		if (wayFilterFileExists)
+		{
+			cerr << "Invalid way filter in " << wayDBFilePath << ".filter: " << index.wayFilter.GetError() << endl;
+			return 1;
+		}
+		if (!index.wayFilter.Parse(WayFilterExpression))
+		{
+			cerr << "Invalid way filter: " << index.wayFilter.GetError() << endl;
+			return 1;
+		}
+	}
+
+	// ids of an existing index must not change, its records can't be decoded without them
+	if (!index.tagDictionary.Load(wayDBFilePath + ".tags") && wayStoreExists)
+	{
+		cerr << "Tag dictionary of the existing way store is missing: " << wayDBFilePath << ".tags" << endl;
+		return 1;
+	}
+	if (!index.tagDictionary.OpenJournal(wayDBFilePath + ".tags"))
+	{
+		cerr << "Failed to write tag dictionary " << wayDBFilePath << ".tags" << endl;
+		return 1;
+	}
+	if (!index.interestingKeys.Load(wayDBFilePath + ".keys"))
+	{
+		index.interestingKeys = TagKeySet(DefaultInterestingKeys);
+	}
+
+	// all band trees share one storage manager, each band's header page id is stored in the .lod file
+	index.zoomBands = ZoomBandSet::CreateDefault();
+
+	const bool UseBulkLoading = true;
+	for (size_t b = 0; b < index.zoomBands.bands.size(); b++)
+	{
+		if (UseBulkLoading)
+		{
+			index.bulkLoadStreams.push_back(new WayBulkLoadStream(wayDBFilePath + ".bulk" + to_string(b)));
+			if (!index.bulkLoadStreams.back()->IsValid())
+			{
+				cerr << "Failed to create bulk load spill file " << wayDBFilePath << ".bulk" << b << endl;
+				return 1;
+			}
+		}
+		else
+		{
+			index.trees.push_back(createNewRTree(*diskfile, 0.7, 100, 100, 3, RV_RSTAR, index.zoomBands.bands[b].indexId));
+		}
+	}
 
 	DB* db = NULL;	
 	bool writeDB = !experimental::filesystem::exists(nodeDBFilePath);
 	Options options;
-	options.comparator = new OSMIdComparator();
 	options.create_if_missing = true;
 	options.write_buffer_size = 100 << 20;
 	options.filter_policy = NewBloomFilterPolicy(32);
-	DB::Open(options, nodeDBFilePath, &db);
+	OpenBigEndianKeyedDB(options, nodeDBFilePath, &db); // migrates node dbs written with native uint64_t keys
 
 	string srcFilePath = "../test/files/" + baseFile;
+
+	if (!index.wayFilter.AcceptsAll()) // otherwise all ways are stored anyway
+	{
+		CollectRelationMemberWayIds(srcFilePath, index.wayFilter, index.relationMemberWayIds);
+	}
+
+	// only store nodes referenced by ways passing the filter (the node db has to be rebuilt if the filter changes)
+	const bool StoreReferencedNodesOnly = true;
+	IdBitmap referencedNodeIds;
+	const bool filterNodes = StoreReferencedNodesOnly && writeDB && !index.wayFilter.AcceptsAll();
+	if (filterNodes)
+	{
+		CollectReferencedNodeIds(srcFilePath, index.wayFilter, index.relationMemberWayIds, referencedNodeIds);
+	}
+
 	FILE* f = fopen(srcFilePath.c_str(), "rb");
 	
 	o5mreader_open(&reader, f);
@@ -972,6 +1803,7 @@ int main()
 
 	uint64_t numDataSetsReadPreviously = 0;
 	uint64_t numDataSetsRead = 0;
+	bool readingRelations = false;
 	while ((ret = o5mreader_iterateDataSet(reader, &ds)) == O5MREADER_ITERATE_RET_NEXT) 
 	{
 		bool readingNodes = true;
@@ -983,7 +1815,7 @@ int main()
 			{
 				if (ds.isEmpty) break;
 
-				if(writeDB)
+				if(writeDB && (!filterNodes || referencedNodeIds.Contains(ds.id)))
 				{
 					NodeValue nv;
 					nv.lon = ds.lon;
@@ -991,7 +1823,7 @@ int main()
 					nv.fileOffset = reader->f->fOffset;
 					nv.readerOffset = reader->offset;
 
-					wb.Put(IdToSlice(ds.id), Slice((const char*)&nv, sizeof(NodeValue)));
+					wb.Put(BigEndianKey(ds.id).ToSlice(), Slice((const char*)&nv, sizeof(NodeValue)));
 				}
 				break;
 			}
@@ -1006,19 +1838,17 @@ int main()
 					db->CompactRange(NULL, NULL);
 				}
 
-				ReadWay(reader, db, tree, ds.id);
+				ReadWay(reader, db, index, ds.id);
 				readingNodes = false;
 				break;
 			case O5MREADER_DS_REL:
-				// Could do something with ds.id
-				// Refs iteration, can be omited
-				while ((ret2 = o5mreader_iterateRefs(reader, &refId, &type, &role)) == O5MREADER_ITERATE_RET_NEXT) {
-					// Could do something with refId (way or node or rel id depends on type), type and role
-				}
-				// Relation tags iteration, can be omited
-				while ((ret2 = o5mreader_iterateTags(reader, &key, &val)) == O5MREADER_ITERATE_RET_NEXT) {
-					// Could do something with tag key and val
+				if (!readingRelations) // make all ways visible to the assembler
+				{
+					readingRelations = true;
+					index.wayStore->Flush();
 				}
+
+				ReadRelation(reader, index, ds.id);
 				readingNodes = false;
 				break;
 		}
@@ -1057,18 +1887,77 @@ int main()
 		}
 	}
 
-	delete options.comparator;
-	delete db;
-	delete options.filter_policy;
-
-	delete tree;
-	delete diskfile;
-
 	o5mreader_close(reader);
 	fclose(f);
 
+	bool isIndexValid = true;
+	if (!index.bulkLoadStreams.empty())
+	{
+		high_resolution_clock::time_point bulkLoadT1 = high_resolution_clock::now();
+
+		for (size_t b = 0; b < index.bulkLoadStreams.size(); b++)
+		{
+			WayBulkLoadStream* bulkLoadStream = index.bulkLoadStreams[b];
+			cout << "Zoom band " << index.zoomBands.bands[b].minZoom << "-" << index.zoomBands.bands[b].maxZoom << ": " << bulkLoadStream->size() << " ways" << endl;
+
+			bulkLoadStream->rewind();
+			if (!bulkLoadStream->IsValid())
+			{
+				cerr << "Failed to write bulk load spill file of zoom band " << b << endl;
+				isIndexValid = false;
+				break;
+			}
+
+			if (bulkLoadStream->hasNext())
+			{
+				// libspatialindex and the storage manager throw Tools::Exception, spill file reads std::exception
+				try
+				{
+					index.trees.push_back(createAndBulkLoadNewRTree(BLM_STR, *bulkLoadStream, *diskfile, BulkLoadFillFactor, 100, 100, 3, RV_RSTAR, index.zoomBands.bands[b].indexId));
+				}
+				catch (Tools::Exception& e)
+				{
+					cerr << "Failed to bulk load zoom band " << b << ": " << e.what() << endl;
+					isIndexValid = false;
+					break;
+				}
+				catch (const exception& e)
+				{
+					cerr << "Failed to bulk load zoom band " << b << ": " << e.what() << endl;
+					isIndexValid = false;
+					break;
+				}
+			}
+			else // bulk loading rejects empty streams
+			{
+				index.trees.push_back(createNewRTree(*diskfile, 0.7, 100, 100, 3, RV_RSTAR, index.zoomBands.bands[b].indexId));
+			}
+			delete bulkLoadStream;
+			index.bulkLoadStreams[b] = NULL;
+		}
+
+		duration<double> time_span = duration_cast<duration<double>>(high_resolution_clock::now() - bulkLoadT1);
+		cout << "Bulk loading took seconds: " << time_span.count() << "                               " << endl;
+	}
+
+	// the .lod file marks a complete index (see GetIndexVersion()), the dictionary is kept in any case
+	if (isIndexValid)
+	{
+		index.zoomBands.Save(wayDBFilePath + ".lod");
+	}
+	index.tagDictionary.CloseJournal();
+	if (!index.tagDictionary.IsJournalValid() || !index.tagDictionary.Save(wayDBFilePath + ".tags"))
+	{
+		cerr << "Failed to write tag dictionary " << wayDBFilePath << ".tags" << endl;
+	}
+	index.interestingKeys.Save(wayDBFilePath + ".keys");
+
+	delete db;
+	delete options.filter_policy;
+
 	cout << "Num Nodes read: " << numDBReadNodes << "                               " << endl;
 	cout << "Num Datasets read: " << numDataSetsRead << "                               " << endl;
+	cout << "Multipolygons assembled: " << numAssembledRelations << " (" << numBrokenRelations << " incomplete)" << endl;
 
-	return 0;
+	return isIndexValid ? 0 : 1;
  }
@@ -0,0 +1,45 @@
+#ifndef __O5MINDEXER_H__
+#define __O5MINDEXER_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <ZFXMath.h>
+
+typedef int32_t O5MCoord;
+
+struct NodeValue
+{
+	O5MCoord lon;
+	O5MCoord lat;
+	uint64_t fileOffset;
+	uint64_t readerOffset;
+};
+
+struct BBox
+{
+	O5MCoord minX;
+	O5MCoord minY;
+	O5MCoord maxX;
+	O5MCoord maxY;
+};
+
+class Tag
+{
+public:
+	std::string key;
+	std::string value;
+};
+
+class Way
+{
+public:
+	uint64_t id;
+	BBox bbox;
+	ZFXMath::TPolygon2D<int32_t> polygon;					// outer ring of areas
+	std::vector<ZFXMath::TPolygon2D<int32_t>> innerRings;	// holes of areas assembled from multipolygon relations
+	std::vector<Tag> tags;
+};
+
+#endif // __O5MINDEXER_H__
@@ -532,6 +532,10 @@ O5mreaderIterateRet o5mreader_readRel(O5mreader *pReader, O5mreaderDataset* ds)
 }
 
 O5mreaderIterateRet o5mreader_iterateDataSet(O5mreader *pReader, O5mreaderDataset* ds) {
+	return o5mreader_iterateDataSetSkipping(pReader, ds, 0);
+}
+
+O5mreaderIterateRet o5mreader_iterateDataSetSkipping(O5mreader *pReader, O5mreaderDataset* ds, uint8_t skipType) {
 	for (;;) {		
 		if ( pReader->offset ) {
 			if ( o5mreader_skipTags(pReader) == O5MREADER_ITERATE_RET_ERR )
@@ -567,6 +571,13 @@ O5mreaderIterateRet o5mreader_iterateDataSet(O5mreader *pReader, O5mreaderDatase
 			}
 			pReader->current = bftell(pReader->f);
 
+			if ( skipType && skipType == ds->type ) {
+				/* jump over the data set without decoding it */
+				bfseek(pReader->f, (long)pReader->offset, SEEK_CUR);
+				pReader->offset = 0;
+				continue;
+			}
+
 			switch ( ds->type ) {
 				case O5MREADER_DS_NODE:
 					return o5mreader_readNode(pReader, ds);
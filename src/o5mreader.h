@@ -89,6 +89,11 @@ const char* o5mreader_strerror(int errCode);
 
 O5mreaderIterateRet o5mreader_iterateDataSet(O5mreader *pReader, O5mreaderDataset* ds);
 
+/* Like o5mreader_iterateDataSet() but data sets of skipType are jumped over without being decoded.
+   Skipped data sets don't update the delta coding and string table state, so skipping is only valid
+   up to the next reset (o5m writers emit one at the start of the way and relation sections). */
+O5mreaderIterateRet o5mreader_iterateDataSetSkipping(O5mreader *pReader, O5mreaderDataset* ds, uint8_t skipType);
+
 O5mreaderIterateRet o5mreader_iterateTags(O5mreader *pReader, char** pKey, char** pVal);
 
 O5mreaderIterateRet o5mreader_iterateNds(O5mreader *pReader, uint64_t *nodeId);
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "../src/MVTWriter.h"
+#include "../src/MVTReader.h"
+#include <check.h>
+
+static const int NumLayers = 2;
+static const int NumFeatures[NumLayers] = { 5, 100 };
+
+// writes the same tile with MVTWriter and with protobuf, a polygon layer and a layer long enough for multi-byte lengths
+static void WriteTile(MVTWriter& writer, vector_tile::Tile& tile) {
+	int l, f;
+	for ( l = 0; l < NumLayers; l++ ) {
+		const std::string name = "layer" + std::to_string(l);
+		vector_tile::Tile_Layer* layer = tile.add_layers();
+		layer->set_name(name);
+		layer->set_version(2);
+		layer->set_extent(4096);
+		writer.BeginLayer(name);
+
+		std::vector<std::string> keys, values;
+		keys.push_back("name");
+		layer->add_keys(keys.back());
+		for ( f = 0; f < NumFeatures[l]; f++ ) {
+			std::vector<uint32_t> geometry;
+			vector_tile::Tile_GeomType type;
+			if ( l == 0 ) {
+				/* square 10,20 - 110,120: MoveTo, LineTo x3 (zigzag deltas), ClosePath */
+				type = vector_tile::Tile_GeomType_POLYGON;
+				const uint32_t square[] = { 1 | (1 << 3), 20, 40, 2 | (3 << 3), 200, 0, 0, 200, 199, 0, 7 | (1 << 3) };
+				geometry.assign(square, square + sizeof(square) / sizeof(square[0]));
+			}
+			else {
+				type = vector_tile::Tile_GeomType_LINESTRING;
+				geometry.push_back(1 | (1 << 3));
+				geometry.push_back(0);
+				geometry.push_back(0);
+				geometry.push_back(2 | (99 << 3));
+				for ( int v = 0; v < 99; v++ ) {
+					geometry.push_back(2 * (v + 1));
+					geometry.push_back(1);
+				}
+			}
+
+			uint32_t tags[2] = { 0, (uint32_t)values.size() };
+			const uint32_t numTags = f % 2 ? 2 : 0;
+			if ( numTags ) values.push_back("feature " + std::to_string(f));
+
+			vector_tile::Tile_Feature* feature = layer->add_features();
+			feature->set_id(1000000000000ull * f + l);
+			for ( uint32_t t = 0; t < numTags; t++ ) feature->add_tags(tags[t]);
+			feature->set_type(type);
+			for ( size_t g = 0; g < geometry.size(); g++ ) feature->add_geometry(geometry[g]);
+			writer.AddFeature(1000000000000ull * f + l, tags, numTags, type, geometry.data(), (uint32_t)geometry.size());
+		}
+		for ( size_t v = 0; v < values.size(); v++ ) layer->add_values()->set_string_value(values[v]);
+		writer.EndLayer(keys, values, 4096);
+	}
+}
+
+START_TEST (check_mvt_writerMatchesProtobuf) {
+	MVTWriter writer;
+	vector_tile::Tile tile;
+	WriteTile(writer, tile);
+
+	std::string data;
+	tile.SerializeToString(&data);
+	fail_unless(writer.GetSize() == data.size(), "Tile size %u != %u.", (unsigned)writer.GetSize(), (unsigned)data.size());
+	fail_unless(memcmp(writer.GetData(), data.data(), data.size()) == 0, "Tile bytes differ from protobuf.");
+
+	/* a cleared writer must produce the same bytes again */
+	writer.Clear();
+	vector_tile::Tile tile2;
+	WriteTile(writer, tile2);
+	fail_unless(writer.GetSize() == data.size() && memcmp(writer.GetData(), data.data(), data.size()) == 0, "Reused writer produces different bytes.");
+}
+END_TEST
+
+START_TEST (check_mvt_readBack) {
+	MVTWriter writer;
+	vector_tile::Tile tile;
+	WriteTile(writer, tile);
+
+	MVTReader reader(writer.GetData(), writer.GetSize());
+	fail_unless(reader.GetNumLayers() == NumLayers, "Expected %d layers, got %u.", NumLayers, (unsigned)reader.GetNumLayers());
+
+	MVTLayer layer;
+	int l = 0;
+	while ( reader.NextLayer(layer) ) {
+		fail_unless(layer.GetName() == "layer" + std::to_string(l), "Layer %d: wrong name.", l);
+		fail_unless(layer.extent == 4096 && layer.version == 2, "Layer %d: wrong extent or version.", l);
+		fail_unless((int)layer.numFeatures == NumFeatures[l] && layer.numKeys == 1 && (int)layer.numValues == NumFeatures[l] / 2,
+			"Layer %d: wrong feature, key or value count.", l);
+
+		MVTFeature feature;
+		MVTGeometryBuffers buffers;
+		int f = 0;
+		while ( layer.NextFeature(feature) ) {
+			fail_unless(feature.id == 1000000000000ull * f + l, "Layer %d feature %d: wrong id.", l, f);
+			fail_unless(feature.tags.GetNumValues() == (f % 2 ? 2u : 0u), "Layer %d feature %d: wrong tags.", l, f);
+
+			buffers.Clear();
+			MVTGeometryReader geometryReader(feature.geometry);
+			uint32_t command, count;
+			int32_t x, y;
+			while ( geometryReader.NextCommand(command, count) ) {
+				if ( command == 7 ) continue;
+				for ( uint32_t i = 0; i < count && geometryReader.NextVertex(x, y); i++ ) {
+					if ( command == 1 ) buffers.BeginPart();
+					buffers.AddVertex(x, y);
+				}
+			}
+			fail_unless(geometryReader.IsValid() && buffers.GetNumParts() == 1, "Layer %d feature %d: invalid geometry.", l, f);
+			if ( l == 0 ) {
+				fail_unless(feature.type == vector_tile::Tile_GeomType_POLYGON && buffers.x.size() == 4 &&
+					buffers.x[0] == 10 && buffers.y[0] == 20 && buffers.x[2] == 110 && buffers.y[2] == 120,
+					"Layer %d feature %d: wrong polygon.", l, f);
+			}
+			else {
+				fail_unless(feature.type == vector_tile::Tile_GeomType_LINESTRING && buffers.x.size() == 100 &&
+					buffers.x[99] == 99 * 100 / 2 && buffers.y[99] == -99, "Layer %d feature %d: wrong line.", l, f);
+			}
+			f++;
+		}
+		fail_unless(f == NumFeatures[l], "Layer %d: read %d features.", l, f);
+
+		const char* key;
+		uint32_t keyLength;
+		fail_unless(layer.NextKey(key, keyLength) && std::string(key, keyLength) == "name" && !layer.NextKey(key, keyLength), "Layer %d: wrong keys.", l);
+		MVTValue value;
+		fail_unless(layer.NextValue(value) && value.type == MVTValue::TypeString && value.GetString() == "feature 1", "Layer %d: wrong first value.", l);
+		fail_unless(layer.IsValid(), "Layer %d is invalid.", l);
+		l++;
+	}
+	fail_unless(l == NumLayers && reader.IsValid(), "Tile is invalid.");
+}
+END_TEST
+
+START_TEST (check_mvt_truncated) {
+	MVTWriter writer;
+	vector_tile::Tile tile;
+	WriteTile(writer, tile);
+
+	/* every prefix of the tile has to be read without running past its end, only whole layers may pass as valid */
+	for ( size_t size = 0; size < writer.GetSize(); size++ ) {
+		std::vector<char> data(writer.GetData(), writer.GetData() + size);
+		MVTReader reader(data.data(), data.size());
+		MVTLayer layer;
+		bool isValid = reader.IsValid();
+		int numLayers = 0;
+		while ( reader.NextLayer(layer) ) {
+			numLayers++;
+			MVTFeature feature;
+			while ( layer.NextFeature(feature) ) {
+				MVTGeometryReader geometryReader(feature.geometry);
+				uint32_t command, count;
+				int32_t x, y;
+				while ( geometryReader.NextCommand(command, count) ) {
+					if ( command == 7 ) continue;
+					for ( uint32_t i = 0; i < count && geometryReader.NextVertex(x, y); i++ );
+				}
+				isValid = isValid && geometryReader.IsValid();
+			}
+			isValid = isValid && layer.IsValid();
+		}
+		isValid = isValid && reader.IsValid();
+		fail_unless(!isValid || numLayers < NumLayers, "Tile cut at %u bytes reported as complete.", (unsigned)size);
+	}
+}
+END_TEST
+
+
+
+Suite *mvt_suite (void) {
+	Suite *s = suite_create ("MVT");
+	TCase *tc_core = tcase_create ("Core");
+	tcase_add_test (tc_core, check_mvt_writerMatchesProtobuf);
+	tcase_add_test (tc_core, check_mvt_readBack);
+	tcase_add_test (tc_core, check_mvt_truncated);
+	suite_add_tcase (s, tc_core);
+
+	return s;
+}
+
+int main (void) {
+
+	int number_failed;
+	Suite *s = mvt_suite ();
+	SRunner *sr = srunner_create (s);
+	srunner_run_all (sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed (sr);
+	srunner_free (sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -356,6 +356,85 @@ START_TEST (check_o5mreader_iterateTags) {
 }
 END_TEST
 
+START_TEST (check_o5mreader_iterateDataSetSkipping) {
+	const uint64_t IDS[5] = {500LL,800LL,9000LL,10000LL,11000LL};
+	const uint64_t nds[2][3] = {
+		{1,5},
+		{1,8,9}
+	};
+	
+	FILE* f;
+	O5mreader* reader;
+	O5mreaderDataset ds;
+	O5mreaderIterateRet ret, ret2;
+	char str[255];
+	int i,j;
+	char *key, *val;
+	uint64_t nodeId;
+	
+	f = fopen("files/test1.o5m","rb");
+	if ( !f ) fail ("File 'files/test1.o5m' can't be opened.");
+	if ( !o5mreader_open(&reader,f) ) {
+		fail (o5mreader_strerror(reader->errCode));
+		fclose(f);
+	}
+	else {
+		i = 0;
+		while( (ret = o5mreader_iterateDataSetSkipping(reader, &ds, O5MREADER_DS_NODE)) == O5MREADER_ITERATE_RET_NEXT ) {
+			++i;
+			sprintf(str,
+				"Node data set not skipped (data set number: '%d', file: 'files/test1.o5m').",
+				i
+			);
+			fail_unless(ds.type != O5MREADER_DS_NODE, str);
+			
+			sprintf(str,
+				"Expected id '%llu', but got: '%llu' (data set number: '%d', file: 'files/test1.o5m').",
+				IDS[i-1], ds.id, i
+			);
+			fail_unless(ds.id == IDS[i-1], str);
+			
+			if ( i <= 2 ) {
+				j = 0;
+				while ( (ret2 = o5mreader_iterateNds(reader,&nodeId)) == O5MREADER_ITERATE_RET_NEXT  ) {
+					++j;
+					sprintf(str,
+						"Expected node id '%llu', but got: '%llu' (data set number: '%d', node number '%d', file: 'files/test1.o5m').",
+						nds[i-1][j-1], nodeId, i, j
+					);
+					fail_unless( nodeId == nds[i-1][j-1], str);
+				}
+			}
+			
+			if ( i == 1 ) {
+				/* string table has been reset before the ways, tags must not depend on skipped nodes */
+				ret2 = o5mreader_iterateTags(reader,&key,&val);
+				fail_unless( O5MREADER_ITERATE_RET_NEXT == ret2 && 0 == strcmp(key,"tag2") && 0 == strcmp(val,"val2"),
+					"Expected tag 'tag2=val2' of first way (file: 'files/test1.o5m')."
+				);
+			}
+		}
+		
+		if ( O5MREADER_ITERATE_RET_ERR == ret ) {
+			sprintf(str,
+				"Iteration of 'files/test1.o5m' failed. %s %s",
+				o5mreader_strerror(reader->errCode),
+				reader->errMsg ? reader->errMsg : ""
+			);
+			fail(str);
+		}
+		
+		sprintf(str,
+			"Iterated wrong number of data sets (%d <> 5) during 'files/test1.o5m' iteration.",
+			i
+		);
+		fail_unless(5 == i, str);
+	}
+	o5mreader_close(reader);
+	fclose(f);
+}
+END_TEST
+
 START_TEST (check_o5mreader_iterateNds) {
   /* unit test code */
 }
@@ -374,6 +453,7 @@ Suite *o5mreader_suite (void) {
 	tcase_add_test (tc_core, check_o5mreader_open);	
 	tcase_add_test (tc_core, check_o5mreader_iterateDataSet);
 	tcase_add_test (tc_core, check_o5mreader_iterateTags);
+	tcase_add_test (tc_core, check_o5mreader_iterateDataSetSkipping);
 	tcase_add_test (tc_core, check_o5mreader_iterateNds);
 	tcase_add_test (tc_core, check_o5mreader_iterateRefs);	
 	suite_add_tcase (s, tc_core);
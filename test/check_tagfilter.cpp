@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "../src/TagFilter.h"
+#include <check.h>
+
+static std::vector<Tag> CreateTags(const char* key1 = NULL, const char* value1 = NULL, const char* key2 = NULL, const char* value2 = NULL) {
+	std::vector<Tag> tags;
+	Tag tag;
+	if ( key1 ) {
+		tag.key = key1;
+		tag.value = value1;
+		tags.push_back(tag);
+	}
+	if ( key2 ) {
+		tag.key = key2;
+		tag.value = value2;
+		tags.push_back(tag);
+	}
+	return tags;
+}
+
+START_TEST (check_tagfilter_empty) {
+	TagFilter filter;
+	fail_unless(filter.Parse(""), "Empty expression rejected.");
+	fail_unless(filter.AcceptsAll() && filter.Matches(CreateTags()), "Empty filter doesn't accept everything.");
+	fail_unless(filter.Parse("  # only a comment\n\n"), "Comment only expression rejected.");
+	fail_unless(filter.AcceptsAll(), "Comment only filter doesn't accept everything.");
+}
+END_TEST
+
+START_TEST (check_tagfilter_grammar) {
+	TagFilter filter;
+	fail_unless(filter.Parse("highway,highway!=footway|path|cycleway; building,!disused # comment; x\n landuse = forest | meadow"),
+		"Valid expression rejected: %s", filter.GetError().c_str());
+
+	fail_unless(filter.Matches(CreateTags("highway", "primary")), "key,key!=v1|v2: expected a match.");
+	fail_unless(!filter.Matches(CreateTags("highway", "path")), "key,key!=v1|v2: unexpected match.");
+	fail_unless(filter.Matches(CreateTags("building", "yes")), "key,!key: expected a match.");
+	fail_unless(!filter.Matches(CreateTags("building", "yes", "disused", "yes")), "key,!key: unexpected match.");
+	fail_unless(!filter.Matches(CreateTags("x", "1")), "Clause inside a comment has been parsed.");
+	fail_unless(filter.Matches(CreateTags("landuse", "meadow")), "key = v1 | v2: expected a match.");
+	fail_unless(!filter.Matches(CreateTags("landuse", "farm")), "key = v1 | v2: unexpected match.");
+	fail_unless(!filter.Matches(CreateTags()), "Way without tags matched.");
+
+	fail_unless(filter.Parse("!area"), "!key rejected.");
+	fail_unless(filter.Matches(CreateTags()) && !filter.Matches(CreateTags("area", "yes")), "!key matches wrong.");
+	fail_unless(filter.Parse("k!=v"), "key!=v rejected.");
+	fail_unless(filter.Matches(CreateTags()) && filter.Matches(CreateTags("k", "w")) && !filter.Matches(CreateTags("k", "v")), "key!=v matches wrong.");
+}
+END_TEST
+
+START_TEST (check_tagfilter_rejects) {
+	TagFilter filter;
+	fail_unless(!filter.Parse("a="), "'a=' accepted.");
+	fail_unless(filter.AcceptsAll(), "Rejected expression left a filter behind.");
+	fail_unless(!filter.Parse("=b"), "'=b' accepted.");
+	fail_unless(!filter.Parse("a; !key=v"), "'!key=v' accepted.");
+	fail_unless(filter.GetError() == "!key=v", "Error names '%s' instead of the malformed term.", filter.GetError().c_str());
+	fail_unless(filter.AcceptsAll(), "Rejected expression left a filter behind.");
+	fail_unless(!filter.Parse("!k!=v"), "'!k!=v' accepted.");
+}
+END_TEST
+
+START_TEST (check_tagfilter_load) {
+	const char* filePath = "check_tagfilter.filter";
+	TagFilter filter;
+	bool exists = true;
+	remove(filePath);
+	fail_unless(!filter.Load(filePath, exists) && !exists, "Missing filter file reported as existing.");
+
+	FILE* f = fopen(filePath, "w");
+	if ( !f ) fail("Filter file can't be created.");
+	fputs("highway\n!x=1\n", f);
+	fclose(f);
+	fail_unless(!filter.Load(filePath, exists) && exists, "Malformed filter file accepted.");
+	fail_unless(filter.GetError() == "!x=1", "Error names '%s' instead of the malformed term.", filter.GetError().c_str());
+
+	f = fopen(filePath, "w");
+	if ( !f ) fail("Filter file can't be created.");
+	fputs("highway\nbuilding=yes\n", f);
+	fclose(f);
+	fail_unless(filter.Load(filePath, exists) && exists, "Valid filter file rejected.");
+	fail_unless(filter.Matches(CreateTags("building", "yes")) && !filter.Matches(CreateTags("building", "no")), "Loaded filter matches wrong.");
+	remove(filePath);
+}
+END_TEST
+
+
+
+Suite *tagfilter_suite (void) {
+	Suite *s = suite_create ("TagFilter");
+	TCase *tc_core = tcase_create ("Core");
+	tcase_add_test (tc_core, check_tagfilter_empty);
+	tcase_add_test (tc_core, check_tagfilter_grammar);
+	tcase_add_test (tc_core, check_tagfilter_rejects);
+	tcase_add_test (tc_core, check_tagfilter_load);
+	suite_add_tcase (s, tc_core);
+
+	return s;
+}
+
+int main (void) {
+
+	int number_failed;
+	Suite *s = tagfilter_suite ();
+	SRunner *sr = srunner_create (s);
+	srunner_run_all (sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed (sr);
+	srunner_free (sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
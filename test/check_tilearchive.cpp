@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <thread>
+#include "../src/TileArchive.h"
+#include <check.h>
+
+static const char* const ArchiveFilePath = "check_tilearchive.mvta";
+static const int Zoom = 6;
+static const int NumTilesPerAxis = 1 << Zoom;
+static const int NumThreads = 4;
+
+// runs of identical tiles (ocean in the south half, land in every 5th column) between unique ones
+static std::string GetTileContent(const int x, const int y) {
+	if ( y >= NumTilesPerAxis / 2 ) return "ocean";
+	if ( x % 5 == 0 ) return "land";
+	return "tile " + std::to_string(x) + "/" + std::to_string(y);
+}
+
+static void WriteArchive(const TileArchiveCompression compression) {
+	TileArchiveWriter writer(ArchiveFilePath, compression);
+	fail_unless(writer.IsOpen(), "Archive can't be created.");
+
+	/* the rows are interleaved between the threads, so the tiles arrive out of order */
+	std::vector<std::thread> threads;
+	for ( int t = 0; t < NumThreads; t++ ) {
+		threads.push_back(std::thread([&writer, t]() {
+			for ( int y = t; y < NumTilesPerAxis; y += NumThreads ) {
+				for ( int x = 0; x < NumTilesPerAxis; x++ ) {
+					const std::string content = GetTileContent(x, y);
+					writer.AddTile(TileCoord{ Zoom, x, y }, content.data(), content.size());
+				}
+			}
+		}));
+	}
+	for ( size_t t = 0; t < threads.size(); t++ ) threads[t].join();
+	writer.AddTile(TileCoord{ Zoom + 1, 0, 0 }, "", 0);
+
+	fail_unless(writer.Finish(), "Archive can't be written.");
+	fail_unless(writer.GetNumTiles() == (uint64_t)(NumTilesPerAxis * NumTilesPerAxis), "Expected %d tiles, got %llu.",
+		NumTilesPerAxis * NumTilesPerAxis, (unsigned long long)writer.GetNumTiles());
+
+	/* ocean, land and the unique tiles of the north half */
+	const uint64_t numUniqueTiles = 2 + (NumTilesPerAxis / 2) * (NumTilesPerAxis - (NumTilesPerAxis + 4) / 5);
+	fail_unless(writer.GetNumUniqueTiles() == numUniqueTiles, "Expected %llu unique tiles, got %llu.",
+		(unsigned long long)numUniqueTiles, (unsigned long long)writer.GetNumUniqueTiles());
+}
+
+START_TEST (check_tilearchive_roundTrip) {
+	const TileArchiveCompression compressions[] = { TileArchiveCompressionNone, TileArchiveCompressionSnappy };
+	std::string tile;
+
+	for ( int c = 0; c < 2; c++ ) {
+		WriteArchive(compressions[c]);
+
+		TileArchiveReader reader;
+		fail_unless(reader.Open(ArchiveFilePath), "Compression %d: archive can't be opened.", c);
+		fail_unless(reader.GetNumEntries() < (uint64_t)(NumTilesPerAxis * NumTilesPerAxis), "Compression %d: runs of identical tiles haven't been merged.", c);
+		for ( int y = 0; y < NumTilesPerAxis; y++ ) {
+			for ( int x = 0; x < NumTilesPerAxis; x++ ) {
+				fail_unless(reader.ReadTile(Zoom, x, y, tile), "Compression %d: tile %d/%d not found.", c, x, y);
+				fail_unless(tile == GetTileContent(x, y), "Compression %d: tile %d/%d has the wrong content.", c, x, y);
+			}
+		}
+		fail_unless(!reader.ReadTile(Zoom - 1, 0, 0, tile), "Compression %d: tile of a missing zoom level found.", c);
+		fail_unless(!reader.ReadTile(Zoom + 1, 0, 0, tile), "Compression %d: empty tile has been stored.", c);
+	}
+	remove(ArchiveFilePath);
+}
+END_TEST
+
+START_TEST (check_tilearchive_corrupt) {
+	WriteArchive(TileArchiveCompressionNone);
+
+	FILE* f = fopen(ArchiveFilePath, "r+b");
+	if ( !f ) fail("Archive can't be opened for writing.");
+	fputc('X', f);
+	fclose(f);
+
+	TileArchiveReader reader;
+	fail_unless(!reader.Open(ArchiveFilePath), "Archive with a wrong magic has been opened.");
+	fail_unless(!reader.Open("check_tilearchive.missing"), "Missing archive has been opened.");
+	remove(ArchiveFilePath);
+}
+END_TEST
+
+
+
+Suite *tilearchive_suite (void) {
+	Suite *s = suite_create ("TileArchive");
+	TCase *tc_core = tcase_create ("Core");
+	tcase_add_test (tc_core, check_tilearchive_roundTrip);
+	tcase_add_test (tc_core, check_tilearchive_corrupt);
+	suite_add_tcase (s, tc_core);
+
+	return s;
+}
+
+int main (void) {
+
+	int number_failed;
+	Suite *s = tilearchive_suite ();
+	SRunner *sr = srunner_create (s);
+	srunner_run_all (sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed (sr);
+	srunner_free (sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
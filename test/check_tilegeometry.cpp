@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "../src/TileClipper.h"
+#include "../src/TileSimplifier.h"
+#include <check.h>
+
+typedef ZFXMath::TPolygon2D<int32_t> Ring;
+typedef ZFXMath::TVector2D<int32_t> Vertex;
+
+static Ring CreateRing(const int32_t* coordinates, const int numVertices) {
+	Ring ring;
+	for ( int v = 0; v < numVertices; v++ ) {
+		ring.AddVertex(Vertex(coordinates[2 * v], coordinates[2 * v + 1]));
+	}
+	return ring;
+}
+
+START_TEST (check_tileclipper_ring) {
+	TileClipper clipper;
+	const BBox box = TileClipper::GetClipBox(100, 10);
+	Ring clipped;
+
+	const int32_t inside[] = { 0,0, 0,50, 50,50, 50,0 };
+	fail_unless(clipper.ClipRing(CreateRing(inside, 4), box, clipped) && clipped.GetNumVertices() == 4, "Ring inside the box has been changed.");
+
+	const int32_t outside[] = { 200,200, 200,300, 300,300 };
+	fail_unless(!clipper.ClipRing(CreateRing(outside, 3), box, clipped), "Ring fully outside the box has been kept.");
+
+	/* rings covering the whole box become the box, in both orientations */
+	const int32_t covering[] = { -1000,-1000, -1000,1000, 1000,1000, 1000,-1000 };
+	const int32_t coveringReversed[] = { 1000,-1000, 1000,1000, -1000,1000, -1000,-1000 };
+	for ( int r = 0; r < 2; r++ ) {
+		const Ring ring = CreateRing(r ? coveringReversed : covering, 4);
+		fail_unless(clipper.ClipRing(ring, box, clipped) && clipped.GetNumVertices() == 4, "Covering ring %d: expected 4 vertices.", r);
+		const int64_t area = clipped.ComputeArea<int64_t>();
+		fail_unless(llabs(area) == 120 * 120, "Covering ring %d: area %lld instead of the box.", r, (long long)area);
+		fail_unless((area < 0) == (ring.ComputeArea<int64_t>() < 0), "Covering ring %d: orientation flipped.", r);
+	}
+}
+END_TEST
+
+START_TEST (check_tileclipper_line) {
+	TileClipper clipper;
+	const BBox box = TileClipper::GetClipBox(100, 10);
+	std::vector<Ring> parts;
+
+	/* leaves the box and comes back */
+	const int32_t twice[] = { -50,50, 50,50, 50,200, 60,200, 60,50, 200,50 };
+	fail_unless(clipper.ClipLine(CreateRing(twice, 6), box, parts) == 2 && parts.size() == 2, "Expected 2 parts, got %u.", (unsigned)parts.size());
+
+	/* the bounding box overlaps, the line doesn't */
+	parts.clear();
+	const int32_t around[] = { -50,-50, -50,200, 200,200 };
+	fail_unless(clipper.ClipLine(CreateRing(around, 3), box, parts) == 0 && parts.empty(), "Line outside the box has been kept.");
+
+	parts.clear();
+	const int32_t diagonal[] = { -100,-100, 300,300 };
+	fail_unless(clipper.ClipLine(CreateRing(diagonal, 2), box, parts) == 1 && parts[0].GetNumVertices() == 2, "Diagonal expected as 1 segment.");
+	fail_unless(parts[0].GetVertices()[0].x == -10 && parts[0].GetVertices()[0].y == -10 &&
+		parts[0].GetVertices()[1].x == 110 && parts[0].GetVertices()[1].y == 110, "Diagonal clipped to the wrong end points.");
+}
+END_TEST
+
+START_TEST (check_tilesimplifier) {
+	TileSimplifier simplifier;
+	const SimplificationMethod methods[] = { SimplifyDouglasPeucker, SimplifyVisvalingam };
+	int m, i;
+
+	for ( m = 0; m < 2; m++ ) {
+		/* noisy circle */
+		Ring circle;
+		for ( i = 0; i < 1000; i++ ) {
+			const double angle = -2 * M_PI * i / 1000;
+			circle.AddVertex(Vertex((int32_t)(1000 * cos(angle)) + i % 2, (int32_t)(1000 * sin(angle))));
+		}
+		const int64_t area = circle.ComputeArea<int64_t>();
+		fail_unless(simplifier.Simplify(circle, true, methods[m], 4.0), "Method %d: circle degenerated.", m);
+		fail_unless(circle.GetNumVertices() >= 3 && circle.GetNumVertices() < 200, "Method %d: circle kept %d vertices.", m, circle.GetNumVertices());
+		fail_unless((circle.ComputeArea<int64_t>() < 0) == (area < 0), "Method %d: circle orientation flipped.", m);
+
+		/* ring smaller than the tolerance collapses */
+		const int32_t tiny[] = { 0,0, 1,0, 1,1, 0,1 };
+		Ring ring = CreateRing(tiny, 4);
+		fail_unless(!simplifier.Simplify(ring, true, methods[m], 8.0), "Method %d: collapsed ring not reported as degenerated.", m);
+
+		/* end points of lines are kept */
+		Ring line;
+		for ( i = 0; i < 100; i++ ) line.AddVertex(Vertex(i * 10, i % 2));
+		Ring untouched = line.Clone<int32_t>(1);
+		fail_unless(simplifier.Simplify(line, false, methods[m], 2.0) && line.GetNumVertices() >= 2, "Method %d: line degenerated.", m);
+		fail_unless(line.GetVertices()[0].x == 0 && line.GetVertices()[line.GetNumVertices() - 1].x == 990, "Method %d: line end points moved.", m);
+
+		fail_unless(simplifier.Simplify(untouched, false, methods[m], 0.0) && untouched.GetNumVertices() == 100, "Method %d: tolerance 0 removed vertices.", m);
+	}
+}
+END_TEST
+
+
+
+Suite *tilegeometry_suite (void) {
+	Suite *s = suite_create ("TileGeometry");
+	TCase *tc_core = tcase_create ("Core");
+	tcase_add_test (tc_core, check_tileclipper_ring);
+	tcase_add_test (tc_core, check_tileclipper_line);
+	tcase_add_test (tc_core, check_tilesimplifier);
+	suite_add_tcase (s, tc_core);
+
+	return s;
+}
+
+int main (void) {
+
+	int number_failed;
+	Suite *s = tilegeometry_suite ();
+	SRunner *sr = srunner_create (s);
+	srunner_run_all (sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed (sr);
+	srunner_free (sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
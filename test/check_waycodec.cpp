@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "../src/WayCodec.h"
+#include <check.h>
+
+static const char* const DictionaryFilePath = "check_waycodec.tags";
+
+static Way CreateWay(const uint64_t id, const int32_t x, const int32_t y, const char* key, const char* value) {
+	Way way;
+	way.id = id;
+	way.bbox.minX = x;
+	way.bbox.minY = y;
+	way.bbox.maxX = x + 1000;
+	way.bbox.maxY = y + 2000;
+
+	way.polygon.AddVertex(ZFXMath::TVector2D<int32_t>(x, y));
+	way.polygon.AddVertex(ZFXMath::TVector2D<int32_t>(x + 1000, y));
+	way.polygon.AddVertex(ZFXMath::TVector2D<int32_t>(x + 1000, y + 2000));
+	way.polygon.AddVertex(ZFXMath::TVector2D<int32_t>(x, y + 2000));
+
+	Tag tag;
+	tag.key = key;
+	tag.value = value;
+	way.tags.push_back(tag);
+	tag.key = "name";
+	tag.value = "way " + std::to_string(id);
+	way.tags.push_back(tag);
+	return way;
+}
+
+static bool IsSameRing(const ZFXMath::TPolygon2D<int32_t>& a, const ZFXMath::TPolygon2D<int32_t>& b) {
+	if ( a.GetNumVertices() != b.GetNumVertices() ) return false;
+	for ( int v = 0; v < a.GetNumVertices(); v++ ) {
+		if ( a.GetVertices()[v].x != b.GetVertices()[v].x || a.GetVertices()[v].y != b.GetVertices()[v].y ) return false;
+	}
+	return true;
+}
+
+START_TEST (check_waycodec_roundTrip) {
+	TagDictionary dictionary;
+	char str[255];
+	int i, t;
+
+	/* early ways store "highway" as a literal, from the MinNumOccurrences'th on it is a dictionary id */
+	for ( i = 0; i < 40; i++ ) {
+		Way way = CreateWay(1000000000ull + i, -1800000000 + i * 100, 850000000 - i * 100, "highway", i % 2 ? "primary" : "residential");
+		if ( i % 4 == 0 ) {
+			ZFXMath::TPolygon2D<int32_t> hole;
+			hole.AddVertex(ZFXMath::TVector2D<int32_t>(way.bbox.minX + 10, way.bbox.minY + 10));
+			hole.AddVertex(ZFXMath::TVector2D<int32_t>(way.bbox.minX + 10, way.bbox.minY + 20));
+			hole.AddVertex(ZFXMath::TVector2D<int32_t>(way.bbox.minX + 20, way.bbox.minY + 20));
+			way.innerRings.push_back(hole);
+		}
+
+		MGArchive archive;
+		EncodeWay(archive, way, dictionary);
+
+		WayRecordView view((const char*)archive.GetData(), (uint32_t)archive.GetSize(), dictionary);
+		sprintf(str, "Header of way %d decoded wrong.", i);
+		fail_unless(view.GetId() == way.id && view.GetNumVertices() == 4 && view.GetNumTags() == 2 &&
+			view.GetBBox().minX == way.bbox.minX && view.GetBBox().maxY == way.bbox.maxY, str);
+
+		std::string value;
+		sprintf(str, "Tag lookup of way %d failed.", i);
+		fail_unless(view.HasKey(TagKey("highway", dictionary)) && !view.HasKey(TagKey("building", dictionary)) &&
+			view.FindValue(TagKey("name", dictionary), value) && value == way.tags[1].value, str);
+
+		Way decoded;
+		view.Decode(decoded);
+		sprintf(str, "Way %d doesn't survive the round trip.", i);
+		fail_unless(decoded.id == way.id && IsSameRing(decoded.polygon, way.polygon) && decoded.innerRings.size() == way.innerRings.size(), str);
+		for ( t = 0; t < (int)way.tags.size(); t++ ) {
+			fail_unless(decoded.tags[t].key == way.tags[t].key && decoded.tags[t].value == way.tags[t].value, str);
+		}
+		if ( !way.innerRings.empty() ) {
+			fail_unless(IsSameRing(decoded.innerRings[0], way.innerRings[0]), str);
+		}
+	}
+
+	uint32_t id;
+	fail_unless(dictionary.Find("highway", id) && dictionary.GetString(id) == "highway", "Frequent key 'highway' has not been learned.");
+	fail_unless(!dictionary.Find("way 1000000000", id), "Unique value has been learned.");
+}
+END_TEST
+
+START_TEST (check_waycodec_rejectsUnknownVersion) {
+	TagDictionary dictionary;
+	Way way = CreateWay(1, 0, 0, "building", "yes");
+	MGArchive archive;
+	EncodeWay(archive, way, dictionary);
+
+	std::string record((const char*)archive.GetData(), (size_t)archive.GetSize());
+	record[0]++;
+	bool isRejected = false;
+	try {
+		WayRecordView view(record.data(), (uint32_t)record.size(), dictionary);
+	}
+	catch (const std::runtime_error&) {
+		isRejected = true;
+	}
+	fail_unless(isRejected, "Record of an unknown version has been accepted.");
+}
+END_TEST
+
+START_TEST (check_tagdictionary_journal) {
+	uint32_t id;
+	int i;
+
+	remove(DictionaryFilePath);
+	{
+		TagDictionary dictionary;
+		fail_unless(!dictionary.Load(DictionaryFilePath), "Missing dictionary file loaded without error.");
+		fail_unless(dictionary.OpenJournal(DictionaryFilePath), "Journal can't be opened.");
+		for ( i = 0; i < (int)TagDictionary::MinNumOccurrences; i++ ) {
+			dictionary.FindOrLearn("highway", id);
+			dictionary.FindOrLearn("yes", id);
+		}
+		fail_unless(dictionary.GetNumStrings() == 2, "Expected 2 learned strings.");
+		/* no Save(): the journal alone has to keep the ids */
+	}
+	{
+		TagDictionary dictionary;
+		fail_unless(dictionary.Load(DictionaryFilePath), "Journaled dictionary can't be loaded.");
+		fail_unless(dictionary.GetNumStrings() == 2 && dictionary.Find("highway", id) && id == 0 && dictionary.Find("yes", id) && id == 1,
+			"Journaled ids changed.");
+	}
+
+	/* torn entry: length 5, but only 2 characters */
+	FILE* f = fopen(DictionaryFilePath, "ab");
+	if ( !f ) fail("Dictionary file can't be appended to.");
+	fputc(5, f);
+	fputs("ab", f);
+	fclose(f);
+	{
+		TagDictionary dictionary;
+		fail_unless(dictionary.Load(DictionaryFilePath), "Dictionary with a torn entry can't be loaded.");
+		fail_unless(dictionary.GetNumStrings() == 2, "Torn entry has been loaded.");
+
+		fail_unless(dictionary.OpenJournal(DictionaryFilePath), "Journal can't be reopened.");
+		for ( i = 0; i < (int)TagDictionary::MinNumOccurrences; i++ ) {
+			dictionary.FindOrLearn("building", id);
+		}
+		fail_unless(id == 2, "Expected id 2 for 'building'.");
+		dictionary.CloseJournal();
+		fail_unless(dictionary.IsJournalValid() && dictionary.Save(DictionaryFilePath), "Dictionary can't be saved.");
+	}
+	{
+		TagDictionary dictionary;
+		fail_unless(dictionary.Load(DictionaryFilePath) && dictionary.GetNumStrings() == 3 && dictionary.Find("building", id) && id == 2,
+			"Saved dictionary doesn't match the journal.");
+	}
+	remove(DictionaryFilePath);
+}
+END_TEST
+
+
+
+Suite *waycodec_suite (void) {
+	Suite *s = suite_create ("WayCodec");
+	TCase *tc_core = tcase_create ("Core");
+	tcase_add_test (tc_core, check_waycodec_roundTrip);
+	tcase_add_test (tc_core, check_waycodec_rejectsUnknownVersion);
+	tcase_add_test (tc_core, check_tagdictionary_journal);
+	suite_add_tcase (s, tc_core);
+
+	return s;
+}
+
+int main (void) {
+
+	int number_failed;
+	Suite *s = waycodec_suite ();
+	SRunner *sr = srunner_create (s);
+	srunner_run_all (sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed (sr);
+	srunner_free (sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}